@@ -120,6 +120,8 @@ testScripts = [
     'mempool_reorg.py',
     'mempool_limit.py',
     'httpbasics.py',
+    'httpchunked.py',
+    'httpeventthreads.py',
     'multi_rpc.py',
     'zapwallettxes.py',
     'proxy_test.py',
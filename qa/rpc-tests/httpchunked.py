@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The e-Gulden Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test large RPC and REST replies, which are sent in chunks while they are
+# being written
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import json
+import struct
+import urllib.parse
+
+COIN = 100000000
+CHUNK_SIZE = 64 * 1024
+FAN_OUT = 500
+SPENDS = 300
+
+def ser_compact_size(n):
+    if n < 253:
+        return struct.pack('B', n)
+    return struct.pack('<BH', 253, n)
+
+def spend_tx(inputs, values, script_pubkey):
+    '''Serialize a transaction spending P2SH(OP_TRUE) outputs to script_pubkey'''
+    tx = struct.pack('<i', 1) + ser_compact_size(len(inputs))
+    for txid, n in inputs:
+        # The scriptSig only pushes the redeem script, OP_TRUE
+        tx += hex_str_to_bytes(txid)[::-1] + struct.pack('<I', n) + b'\x02\x01\x51' + b'\xff\xff\xff\xff'
+    tx += ser_compact_size(len(values))
+    for value in values:
+        tx += struct.pack('<q', value) + ser_compact_size(len(script_pubkey)) + script_pubkey
+    return bytes_to_hex_str(tx + struct.pack('<I', 0))
+
+class HTTPChunkedTest (BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 1
+        self.setup_clean_chain = True
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-rest"]])
+
+    def http_request(self, method, path, body=None):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        headers = {"Authorization": "Basic " + str_to_b64str(url.username + ':' + url.password)}
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request(method, path, body, headers)
+        resp = conn.getresponse()
+        data = resp.read()
+        conn.close()
+        assert_equal(resp.status, 200)
+        # Larger than one chunk, so it went out with chunked transfer encoding
+        assert_equal(resp.getheader('Transfer-Encoding'), 'chunked')
+        assert_greater_than(len(data), CHUNK_SIZE)
+        return json.loads(data.decode('utf-8'), parse_float=Decimal)
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = node.decodescript("51")['p2sh']
+        script_pubkey = hex_str_to_bytes(node.validateaddress(address)['scriptPubKey'])
+        node.generatetoaddress(20, address)
+
+        # One transaction with many outputs makes a large block
+        coinbase = node.getblock(node.getblockhash(2))['tx'][0]
+        value = int(node.gettxout(coinbase, 0)['value'] * COIN) - COIN // 10
+        fan_hex = spend_tx([(coinbase, 0)], [value // FAN_OUT] * FAN_OUT, script_pubkey)
+        fan_txid = node.sendrawtransaction(fan_hex)
+        block_hash = node.generatetoaddress(1, address)[0]
+
+        block = self.http_request('GET', '/rest/block/%s.json' % block_hash)
+        rpc_block = node.getblock(block_hash)
+        for key in rpc_block:
+            if key != 'tx':
+                assert_equal(block[key], rpc_block[key])
+        assert_equal([tx['txid'] for tx in block['tx']], rpc_block['tx'])
+        assert_equal(block['tx'][1], node.decoderawtransaction(fan_hex))
+
+        # Many transactions make a large mempool
+        txids = set()
+        for n in range(SPENDS):
+            txids.add(node.sendrawtransaction(spend_tx([(fan_txid, n)], [value // FAN_OUT - COIN // 1000], script_pubkey)))
+        request = json.dumps({"method": "getrawmempool", "params": [True], "id": 1})
+        reply = self.http_request('POST', '/', request)
+        assert_equal(reply['error'], None)
+        assert_equal(reply['id'], 1)
+        assert_equal(set(reply['result'].keys()), txids)
+        for txid, entry in reply['result'].items():
+            assert_equal(entry['fee'], Decimal('0.001'))
+            assert_equal(entry['depends'], [])
+        assert_equal(reply['result'], node.getrawmempool(True))
+
+        contents = self.http_request('GET', '/rest/mempool/contents.json')
+        assert_equal(contents, reply['result'])
+
+if __name__ == '__main__':
+    HTTPChunkedTest ().main ()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The e-Gulden Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test serving RPC from several HTTP event threads (-rpceventthreads)
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy
+from test_framework.util import *
+
+import os
+import subprocess
+import threading
+
+EVENT_THREADS = 4
+CLIENTS = 8
+CALLS_PER_CLIENT = 10
+
+class HTTPEventThreadsTest (BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-rpceventthreads=%d" % EVENT_THREADS, "-rpcworkqueue=64"]])
+
+    def check_counters(self, info):
+        # Every request read by an event thread was either handled by a
+        # worker or rejected, except for the gethttpinfo call itself
+        assert_equal(len(info['eventrequests']), info['eventthreads'])
+        assert_equal(sum(info['eventrequests']), info['requests'] + info['rejected'] + 1)
+
+    def run_test(self):
+        node = self.nodes[0]
+        info0 = node.gethttpinfo()
+        # Without SO_REUSEPORT support in libevent there is a single one
+        assert(info0['eventthreads'] in (1, EVENT_THREADS))
+        self.check_counters(info0)
+
+        # Concurrent clients, each call on a new connection so they are
+        # spread over the event threads
+        url = rpc_url(0)
+        failures = []
+        def client():
+            try:
+                for i in range(CALLS_PER_CLIENT):
+                    assert_equal(AuthServiceProxy(url).getblockcount(), 0)
+            except Exception as e:
+                failures.append(e)
+        threads = [threading.Thread(target=client) for i in range(CLIENTS)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert_equal(failures, [])
+
+        info1 = node.gethttpinfo()
+        self.check_counters(info1)
+        calls = CLIENTS * CALLS_PER_CLIENT
+        assert_equal(info1['rejected'], info0['rejected'])
+        # The calls, plus the previous gethttpinfo that is done by now
+        assert_equal(info1['requests'] - info0['requests'], calls + 1)
+        assert_equal(sum(info1['eventrequests']) - sum(info0['eventrequests']), calls + 1)
+        if info1['eventthreads'] > 1:
+            busy = [a - b for a, b in zip(info1['eventrequests'], info0['eventrequests']) if a > b]
+            assert_greater_than(len(busy), 1)
+
+        # A second node cannot take over the RPC port, SO_REUSEPORT or not
+        args = [os.getenv("LITECOIND", "litecoind"), "-datadir=" + os.path.join(self.options.tmpdir, "node1"),
+                "-rpceventthreads=%d" % EVENT_THREADS, "-rpcport=%d" % rpc_port(0)]
+        process = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            assert(process.wait(timeout=60) != 0)
+        except subprocess.TimeoutExpired:
+            process.kill()
+            process.wait()
+            raise AssertionError("a second node could bind the RPC port in use")
+        assert_equal(node.getblockcount(), 0)
+
+if __name__ == '__main__':
+    HTTPEventThreadsTest ().main ()
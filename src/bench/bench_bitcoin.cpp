@@ -6,14 +6,18 @@
 
 #include "key.h"
 #include "main.h"
+#include "pubkey.h"
+#include "script/sigcache.h"
 #include "util.h"
 
 int
 main(int argc, char** argv)
 {
     ECC_Start();
+    ECCVerifyHandle verifyHandle;
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
+    InitSignatureCache();
 
     benchmark::BenchRunner::RunAll();
 
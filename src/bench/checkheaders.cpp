@@ -0,0 +1,63 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "pow.h"
+
+#include <boost/thread.hpp>
+
+static const unsigned int BENCH_HEADERS = 64;
+
+/** Builds a chain of regtest headers that all pass the proof-of-work check */
+static std::vector<CBlockHeader> CreateHeaders()
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    std::vector<CBlockHeader> headers;
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    for (unsigned int i = 0; i < BENCH_HEADERS; i++) {
+        header.hashPrevBlock = header.GetHash();
+        header.nTime++;
+        while (!CheckProofOfWork(header.GetPoWHash(), header.nBits, consensusParams))
+            header.nNonce++;
+        headers.push_back(header);
+    }
+    return headers;
+}
+
+static void CheckHeadersPoW(benchmark::State& state, int nThreads)
+{
+    std::vector<CBlockHeader> headers = CreateHeaders();
+
+    boost::thread_group threadGroup;
+    nHeaderCheckThreads = nThreads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(&ThreadHeaderCheck);
+
+    while (state.KeepRunning()) {
+        std::vector<unsigned char> vPoWChecked(headers.size(), 0);
+        assert(CheckBlockHeadersPoW(headers, vPoWChecked, Params().GetConsensus()));
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nHeaderCheckThreads = 0;
+}
+
+static void CheckHeadersPoW_1Thread(benchmark::State& state)
+{
+    CheckHeadersPoW(state, 0);
+}
+
+static void CheckHeadersPoW_4Threads(benchmark::State& state)
+{
+    CheckHeadersPoW(state, 4);
+}
+
+BENCHMARK(CheckHeadersPoW_1Thread);
+BENCHMARK(CheckHeadersPoW_4Threads);
@@ -0,0 +1,111 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "checkqueue.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/** Number of transactions in the replayed block */
+static const int CHECKQUEUE_BENCH_TXS = 1000;
+
+/**
+ * A block of pay-to-pubkey-hash transactions with the input counts seen on
+ * mainnet: most spend one or two outputs, a few consolidate many.
+ */
+class ScriptCheckBlock
+{
+public:
+    CMutableTransaction txFunding;
+    std::vector<CTransaction> vtx;
+    std::vector<PrecomputedTransactionData> vtxdata;
+
+    ScriptCheckBlock()
+    {
+        CBasicKeyStore keystore;
+        std::vector<CScript> vScripts;
+        for (int i = 0; i < 16; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            vScripts.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+        }
+
+        seed_insecure_rand(true);
+        std::vector<int> vInputs;
+        for (int i = 0; i < CHECKQUEUE_BENCH_TXS; i++) {
+            uint32_t r = insecure_rand() % 100;
+            vInputs.push_back(r < 70 ? 1 : r < 90 ? 2 : r < 98 ? 5 : 20);
+            for (int j = 0; j < vInputs.back(); j++) {
+                txFunding.vout.push_back(CTxOut(COIN, vScripts[txFunding.vout.size() % vScripts.size()]));
+            }
+        }
+        CTransaction funding(txFunding);
+
+        uint32_t nPrevOut = 0;
+        for (int i = 0; i < CHECKQUEUE_BENCH_TXS; i++) {
+            CMutableTransaction tx;
+            for (int j = 0; j < vInputs[i]; j++)
+                tx.vin.push_back(CTxIn(COutPoint(funding.GetHash(), nPrevOut++)));
+            tx.vout.push_back(CTxOut(vInputs[i] * COIN, vScripts[i % vScripts.size()]));
+            for (unsigned int j = 0; j < tx.vin.size(); j++)
+                assert(SignSignature(keystore, funding, tx, j, SIGHASH_ALL));
+            vtx.push_back(CTransaction(tx));
+        }
+
+        // PrecomputedTransactionData keeps no reference to the transaction
+        vtxdata.reserve(vtx.size());
+        for (unsigned int i = 0; i < vtx.size(); i++)
+            vtxdata.push_back(PrecomputedTransactionData(vtx[i]));
+    }
+
+    /** Queue the checks the way ConnectBlock does, one transaction at a time */
+    bool Verify(CCheckQueue<CScriptCheck>* pqueue)
+    {
+        CCheckQueueControl<CScriptCheck> control(pqueue);
+        for (unsigned int i = 0; i < vtx.size(); i++) {
+            std::vector<CScriptCheck> vChecks;
+            for (unsigned int j = 0; j < vtx[i].vin.size(); j++) {
+                const CTxOut& prevout = txFunding.vout[vtx[i].vin[j].prevout.n];
+                vChecks.push_back(CScriptCheck());
+                CScriptCheck check(prevout, vtx[i], j, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG, false, &vtxdata[i]);
+                check.swap(vChecks.back());
+            }
+            control.Add(vChecks);
+        }
+        return control.Wait();
+    }
+};
+
+static void CheckQueue(benchmark::State& state, int nThreads)
+{
+    ScriptCheckBlock block;
+
+    CCheckQueue<CScriptCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning())
+        assert(block.Verify(&queue));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CheckQueue_1Thread(benchmark::State& state) { CheckQueue(state, 1); }
+static void CheckQueue_4Threads(benchmark::State& state) { CheckQueue(state, 4); }
+static void CheckQueue_16Threads(benchmark::State& state) { CheckQueue(state, 16); }
+
+BENCHMARK(CheckQueue_1Thread);
+BENCHMARK(CheckQueue_4Threads);
+BENCHMARK(CheckQueue_16Threads);
@@ -10,6 +10,7 @@
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
+#include "crypto/scrypt.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
@@ -69,6 +70,38 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+/* Hashes nInputs block headers per iteration with the multi-lane scrypt API */
+static void ScryptMulti(benchmark::State& state, unsigned int nInputs)
+{
+    std::vector<std::vector<char> > in(nInputs, std::vector<char>(80, 0));
+    std::vector<uint256> hashes(nInputs);
+    std::vector<const char*> inputs(nInputs);
+    std::vector<char*> outputs(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        in[i][0] = i;
+        inputs[i] = &in[i][0];
+        outputs[i] = (char*)hashes[i].begin();
+    }
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_sp_multi(&inputs[0], &outputs[0], nInputs, &scratchpad[0]);
+}
+
+static void Scrypt_1Lane(benchmark::State& state)
+{
+    ScryptMulti(state, 1);
+}
+
+static void Scrypt_4Lanes(benchmark::State& state)
+{
+    ScryptMulti(state, 4);
+}
+
+static void Scrypt_8Lanes(benchmark::State& state)
+{
+    ScryptMulti(state, 8);
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +109,6 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+BENCHMARK(Scrypt_1Lane);
+BENCHMARK(Scrypt_4Lanes);
+BENCHMARK(Scrypt_8Lanes);
@@ -0,0 +1,61 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "kgw.h"
+
+static const uint64_t KGW_TARGET_SPACING = 120;
+static const uint64_t KGW_PAST_BLOCKS_MIN = 21600 / 512;
+static const uint64_t KGW_PAST_BLOCKS_MAX = 604800 / 512;
+
+/** Synthetic 10k block chain with irregular block times and difficulty */
+static void CreateChain(std::vector<CBlockIndex>& blocks)
+{
+    blocks.resize(10000);
+    uint32_t nRand = 12345;
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        nRand = nRand * 1103515245 + 12345;
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = i ? blocks[i - 1].nTime + 5 + (nRand >> 16) % 230 : 1400000000;
+        blocks[i].nBits = 0x1b040000 + (nRand & 0xffff);
+    }
+}
+
+// Full walk from the tip, as done for every new header before caching
+static void KimotoGravityWell_Walk(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    std::vector<CBlockIndex> blocks;
+    CreateChain(blocks);
+    while (state.KeepRunning())
+        CalculateKimotoGravityWell(&blocks.back(), KGW_TARGET_SPACING, KGW_PAST_BLOCKS_MIN, KGW_PAST_BLOCKS_MAX, Params().GetConsensus());
+}
+
+static void KimotoGravityWell_EventHorizonDeviation(benchmark::State& state)
+{
+    double sum = 0;
+    while (state.KeepRunning()) {
+        for (uint64_t PastBlocksMass = 1; PastBlocksMass <= KGW_PAST_BLOCKS_MAX; PastBlocksMass++)
+            sum += GetEventHorizonDeviation(PastBlocksMass);
+    }
+    assert(sum > 0);
+}
+
+static void KimotoGravityWell_EventHorizonDeviationPow(benchmark::State& state)
+{
+    double sum = 0;
+    while (state.KeepRunning()) {
+        for (uint64_t PastBlocksMass = 1; PastBlocksMass <= KGW_PAST_BLOCKS_MAX; PastBlocksMass++)
+            sum += CalculateEventHorizonDeviation(PastBlocksMass);
+    }
+    assert(sum > 0);
+}
+
+BENCHMARK(KimotoGravityWell_Walk);
+BENCHMARK(KimotoGravityWell_EventHorizonDeviation);
+BENCHMARK(KimotoGravityWell_EventHorizonDeviationPow);
@@ -0,0 +1,72 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+
+/** Writes the genesis block to a temporary block file and indexes it */
+class ReadBlockSetup
+{
+public:
+    boost::filesystem::path pathTemp;
+    CBlock block;
+    uint256 hash;
+    CBlockIndex index;
+
+    ReadBlockSetup()
+    {
+        SelectParams(CBaseChainParams::MAIN);
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_egulden_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp / "blocks");
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+
+        block = Params().GenesisBlock();
+        hash = block.GetHash();
+
+        CDiskBlockPos pos(0, 0);
+        assert(WriteBlockToDisk(block, pos, Params().MessageStart()));
+
+        index = CBlockIndex(block);
+        index.phashBlock = &hash;
+        index.nFile = pos.nFile;
+        index.nDataPos = pos.nPos;
+        index.nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA;
+    }
+
+    ~ReadBlockSetup()
+    {
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+// Reading by position re-checks the scrypt PoW, as every read used to do
+static void ReadBlockFromDisk_CheckPoW(benchmark::State& state)
+{
+    ReadBlockSetup setup;
+    CBlock block;
+    while (state.KeepRunning())
+        assert(ReadBlockFromDisk(block, setup.index.GetBlockPos(), Params().GetConsensus()));
+}
+
+// Reading through the block index trusts the PoW check done when the header was accepted
+static void ReadBlockFromDisk_Index(benchmark::State& state)
+{
+    ReadBlockSetup setup;
+    CBlock block;
+    while (state.KeepRunning())
+        assert(ReadBlockFromDisk(block, &setup.index, Params().GetConsensus()));
+}
+
+BENCHMARK(ReadBlockFromDisk_CheckPoW);
+BENCHMARK(ReadBlockFromDisk_Index);
@@ -0,0 +1,144 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "random.h"
+#include "rpc/register.h"
+#include "rpc/server.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <univalue.h>
+
+/** Number of blocks in the test chain */
+static const int RPCBATCH_BENCH_BLOCKS = 100;
+/** Number of calls in a batch, as sent by indexers */
+static const int RPCBATCH_BENCH_CALLS = 500;
+
+/** A regtest chain in a temporary datadir, like TestChain100Setup */
+class RPCBatchSetup
+{
+public:
+    boost::filesystem::path pathTemp;
+    CCoinsViewDB *pcoinsdbview;
+    std::vector<uint256> vBlockHashes;
+    std::vector<uint256> vCoinbaseTxids;
+
+    RPCBatchSetup()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        const CChainParams& chainparams = Params();
+        // Only the first run gets to register the commands
+        if (!tableRPC["getblock"]) {
+            RegisterAllCoreRPCCommands(tableRPC);
+            SetRPCWarmupFinished();
+        }
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_egulden_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsflusher = new CCoinsViewFlusher(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+        assert(InitBlockIndex(chainparams));
+        {
+            CValidationState state;
+            assert(ActivateBestChain(state, chainparams));
+        }
+
+        CScript scriptPubKey = CScript() << OP_TRUE;
+        for (int i = 0; i < RPCBATCH_BENCH_BLOCKS; i++) {
+            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+            CBlock& block = pblocktemplate->block;
+            unsigned int nExtraNonce = 0;
+            IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+            while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, chainparams.GetConsensus()))
+                ++block.nNonce;
+            CValidationState state;
+            assert(ProcessNewBlock(state, chainparams, NULL, &block, true, NULL, false));
+            vBlockHashes.push_back(block.GetHash());
+            vCoinbaseTxids.push_back(block.vtx[0].GetHash());
+        }
+        assert(chainActive.Height() == RPCBATCH_BENCH_BLOCKS);
+    }
+
+    ~RPCBatchSetup()
+    {
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsflusher;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pcoinsTip = NULL;
+        pcoinsflusher = NULL;
+        pblocktree = NULL;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+
+    /** Alternating verbose getblock and getrawtransaction calls, as an indexer walking the chain sends */
+    UniValue MakeBatch() const
+    {
+        UniValue vReq(UniValue::VARR);
+        for (int i = 0; i < RPCBATCH_BENCH_CALLS; i++) {
+            int nBlock = (i / 2) % RPCBATCH_BENCH_BLOCKS;
+            UniValue params(UniValue::VARR);
+            UniValue req(UniValue::VOBJ);
+            if (i % 2 == 0) {
+                params.push_back(vBlockHashes[nBlock].GetHex());
+                req.push_back(Pair("method", "getblock"));
+            } else {
+                params.push_back(vCoinbaseTxids[nBlock].GetHex());
+                params.push_back(1);
+                req.push_back(Pair("method", "getrawtransaction"));
+            }
+            req.push_back(Pair("params", params));
+            req.push_back(Pair("id", i));
+            vReq.push_back(req);
+        }
+        return vReq;
+    }
+};
+
+static void RPCBatch(benchmark::State& state, int nParallel)
+{
+    RPCBatchSetup setup;
+    mapArgs["-rpcbatchparallel"] = itostr(nParallel);
+    UniValue vReq = setup.MakeBatch();
+
+    // Helpers get a thread each, standing in for the HTTP worker threads
+    boost::thread_group threadGroup;
+    RPCQueueWorkFn queueWork = [&threadGroup](const boost::function<void ()>& func) {
+        threadGroup.create_thread(func);
+        return true;
+    };
+
+    while (state.KeepRunning()) {
+        UniValue vReply;
+        assert(vReply.read(JSONRPCExecBatch(vReq, queueWork)));
+        assert(vReply.size() == vReq.size() && find_value(vReply[vReply.size() - 1], "error").isNull());
+        threadGroup.join_all();
+    }
+
+    mapArgs.erase("-rpcbatchparallel");
+}
+
+static void RPCBatch_Serial(benchmark::State& state) { RPCBatch(state, 1); }
+static void RPCBatch_4Parallel(benchmark::State& state) { RPCBatch(state, 4); }
+
+BENCHMARK(RPCBatch_Serial);
+BENCHMARK(RPCBatch_4Parallel);
@@ -0,0 +1,110 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/common.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
+/** Number of cache operations per thread per iteration */
+static const int SIGCACHE_BENCH_OPS = 1024;
+
+/**
+ * Mirrors the use of the signature cache during block validation: the
+ * script check threads look up entries (and erase them, as blocks do not
+ * store) without a lock, while inserts for new mempool transactions are
+ * serialized. One in 16 operations is an insert.
+ */
+class SigCacheContention
+{
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type cache;
+    boost::mutex cs;
+    std::vector<uint256> entries;
+
+    boost::thread_group threads;
+    boost::barrier barrier;
+    bool fStop;
+
+    void Work(int nThread)
+    {
+        uint32_t nPos = nThread * 7919;
+        for (int i = 0; i < SIGCACHE_BENCH_OPS; i++) {
+            const uint256& entry = entries[(nPos + i) % entries.size()];
+            if (i % 16 == 0) {
+                boost::unique_lock<boost::mutex> lock(cs);
+                cache.insert(entry);
+            } else {
+                cache.contains(entry, i % 4 == 0);
+            }
+        }
+    }
+
+    void Thread(int nThread)
+    {
+        while (true) {
+            barrier.wait();
+            if (fStop)
+                return;
+            Work(nThread);
+            barrier.wait();
+        }
+    }
+
+public:
+    SigCacheContention(int nThreads) : barrier(nThreads + 1), fStop(false)
+    {
+        cache.setup_bytes(DEFAULT_MAX_SIG_CACHE_SIZE << 20);
+
+        seed_insecure_rand(true);
+        entries.resize(1 << 16);
+        for (size_t i = 0; i < entries.size(); i++) {
+            for (int j = 0; j < 8; j++)
+                WriteLE32(entries[i].begin() + 4 * j, insecure_rand());
+            if (i % 2 == 0)
+                cache.insert(entries[i]);
+        }
+
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&SigCacheContention::Thread, this, i));
+    }
+
+    ~SigCacheContention()
+    {
+        fStop = true;
+        barrier.wait();
+        threads.join_all();
+    }
+
+    /** Let every thread do SIGCACHE_BENCH_OPS operations */
+    void Round()
+    {
+        barrier.wait();
+        barrier.wait();
+    }
+};
+
+static void SigCache(benchmark::State& state, int nThreads)
+{
+    SigCacheContention bench(nThreads);
+    while (state.KeepRunning())
+        bench.Round();
+}
+
+static void SigCache_1Thread(benchmark::State& state) { SigCache(state, 1); }
+static void SigCache_4Threads(benchmark::State& state) { SigCache(state, 4); }
+static void SigCache_16Threads(benchmark::State& state) { SigCache(state, 16); }
+
+BENCHMARK(SigCache_1Thread);
+BENCHMARK(SigCache_4Threads);
+BENCHMARK(SigCache_16Threads);
@@ -202,6 +202,16 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Cached OeruShield identification of this block, which only depends on the
+    //! block itself: -1 if not determined yet, 0 if not identified, 1 if signed by oeruIdentityKey.
+    //! Filled in by COeruShield so that ancestors don't have to be read back from disk.
+    mutable int8_t nOeruIdentified;
+    mutable uint160 oeruIdentityKey;
+
+    //! (memory only) Cached Kimoto Gravity Well target for the child of this block, 0 if not
+    //! calculated yet. It only depends on this block and its ancestors, so it never goes stale.
+    mutable uint32_t nKGWNextBits;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -216,6 +226,9 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nOeruIdentified = -1;
+        oeruIdentityKey.SetNull();
+        nKGWNextBits = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
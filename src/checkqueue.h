@@ -6,6 +6,8 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,7 +18,7 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,135 +27,183 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker owns a deque of verifications, the master uses the first
+  * one. Add() spreads new work over the deques, and each worker takes
+  * batches from the back of its own deque. A worker that runs out steals
+  * from the front of the others, so the shared mutex is only needed to
+  * sleep and to wake up. Batches get smaller as the queued work runs low,
+  * so all workers finish at about the same time. After the first failed
+  * verification the remaining ones are discarded without being run.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
-
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    //! Verifications owned by one worker, protected by its own mutex
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    //! Maximum number of worker deques, further workers share one
+    static const unsigned int MAX_WORKER_QUEUES = 64;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The per-worker deques; the master uses the first one
+    WorkerQueue vQueues[MAX_WORKER_QUEUES];
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Number of worker deques in use (including the master's)
+    std::atomic<unsigned int> nQueues;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Next deque Add() starts filling
+    unsigned int nNextQueue;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of verifications sitting in the deques, updated with the deque's mutex held
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Mutex to protect sleeping and waking up
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /**
+     * Move a batch of verifications into vChecks, from the back of our own
+     * deque or else from the front of another worker's.
+     * Do not try to do everything at once, but aim for increasingly smaller
+     * batches so all workers finish approximately simultaneously.
+     */
+    bool TakeWork(unsigned int nOwn, std::vector<T>& vChecks)
+    {
+        unsigned int nCount = nQueues.load();
+        unsigned int nNow = std::max(1U, std::min(nBatchSize, nQueued.load() / (nCount + 1)));
+        for (unsigned int i = 0; i < nCount; i++) {
+            unsigned int nVictim = (nOwn + i) % nCount;
+            WorkerQueue& worker = vQueues[nVictim];
+            boost::unique_lock<boost::mutex> lock(worker.mutex);
+            if (worker.queue.empty())
+                continue;
+            unsigned int nTake = std::min((unsigned int)worker.queue.size(), nNow);
+            vChecks.resize(nTake);
+            for (unsigned int j = 0; j < nTake; j++) {
+                // Swap instead of copying to keep the lock short
+                if (nVictim == nOwn) {
+                    vChecks[j].swap(worker.queue.back());
+                    worker.queue.pop_back();
+                } else {
+                    vChecks[j].swap(worker.queue.front());
+                    worker.queue.pop_front();
+                }
+            }
+            nQueued -= nTake;
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nOwn, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
+        while (true) {
+            if (!TakeWork(nOwn, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                if (nQueued > 0)
+                    continue;
+                if (fMaster) {
+                    if (nTodo == 0) {
+                        // reset the status for new work later, and return the current one
+                        return fAllOk.exchange(true);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                    condMaster.wait(lock);
+                } else {
+                    condWorker.wait(lock); // wait
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
+
+            // execute work, unless another worker already found a failure
+            BOOST_FOREACH (T& check, vChecks) {
+                if (!fAllOk.load(std::memory_order_relaxed))
+                    break;
+                if (!check())
+                    fAllOk = false;
+            }
+            unsigned int nNow = vChecks.size();
             vChecks.clear();
-        } while (true);
+            if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nQueues(1), nNextQueue(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nOwn = nQueues.load();
+        while (nOwn < MAX_WORKER_QUEUES && !nQueues.compare_exchange_weak(nOwn, nOwn + 1)) {}
+        Loop(nOwn < MAX_WORKER_QUEUES ? nOwn : MAX_WORKER_QUEUES - 1);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+
+        // Count the work before it can be taken, so nTodo never underflows
         nTodo += vChecks.size();
+
+        // Spread the checks over the deques in equal runs, starting where the
+        // previous call left off so single checks are spread as well
+        unsigned int nCount = nQueues.load();
+        unsigned int nRun = (vChecks.size() + nCount - 1) / nCount;
+        for (unsigned int i = 0; i < vChecks.size(); i += nRun) {
+            WorkerQueue& worker = vQueues[nNextQueue];
+            nNextQueue = (nNextQueue + 1) % nCount;
+            unsigned int nEnd = std::min((unsigned int)vChecks.size(), i + nRun);
+            boost::unique_lock<boost::mutex> lock(worker.mutex);
+            for (unsigned int j = i; j < nEnd; j++) {
+                worker.queue.push_back(T());
+                vChecks[j].swap(worker.queue.back());
+            }
+            nQueued += nEnd - i;
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -163,8 +213,7 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && fAllOk == true);
     }
 
 };
@@ -47,6 +47,13 @@
 #include <unistd.h>
 #endif
 
+// Wait on sockets with poll() and epoll instead of select(), which lifts the
+// FD_SETSIZE limit on the socket number
+#ifdef HAVE_SYS_EPOLL_H
+#define USE_POLL
+#include <poll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT        0
 #else
@@ -84,7 +91,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -327,3 +327,193 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+/*
+ * Multi-lane scrypt: hashes several inputs in one pass by interleaving
+ * their states, so that every Salsa20/8 operation is applied to the same
+ * word of all lanes at once with one vector instruction. On x86 the same
+ * code is built for AVX2 and AVX-512VL and picked at runtime.
+ */
+#if defined(__GNUC__)
+#define SCRYPT_MULTI_VECTOR 1
+#if defined(__x86_64__) || defined(__i386__)
+#define SCRYPT_MULTI_X86 1
+#endif
+
+typedef uint32_t scrypt_v4 __attribute__((vector_size(16)));
+typedef uint32_t scrypt_v8 __attribute__((vector_size(32)));
+
+#define SALSA_MULTI_STEP(a, b, c, r) x[a] ^= ROTL(x[b] + x[c], r);
+
+template <typename V>
+static inline __attribute__((always_inline)) void xor_salsa8_multi(V B[16], const V Bx[16])
+{
+	V x[16];
+	int i, k;
+
+	for (k = 0; k < 16; k++)
+		x[k] = (B[k] ^= Bx[k]);
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		SALSA_MULTI_STEP( 4,  0, 12,  7) SALSA_MULTI_STEP( 9,  5,  1,  7)
+		SALSA_MULTI_STEP(14, 10,  6,  7) SALSA_MULTI_STEP( 3, 15, 11,  7)
+
+		SALSA_MULTI_STEP( 8,  4,  0,  9) SALSA_MULTI_STEP(13,  9,  5,  9)
+		SALSA_MULTI_STEP( 2, 14, 10,  9) SALSA_MULTI_STEP( 7,  3, 15,  9)
+
+		SALSA_MULTI_STEP(12,  8,  4, 13) SALSA_MULTI_STEP( 1, 13,  9, 13)
+		SALSA_MULTI_STEP( 6,  2, 14, 13) SALSA_MULTI_STEP(11,  7,  3, 13)
+
+		SALSA_MULTI_STEP( 0, 12,  8, 18) SALSA_MULTI_STEP( 5,  1, 13, 18)
+		SALSA_MULTI_STEP(10,  6,  2, 18) SALSA_MULTI_STEP(15, 11,  7, 18)
+
+		/* Operate on rows. */
+		SALSA_MULTI_STEP( 1,  0,  3,  7) SALSA_MULTI_STEP( 6,  5,  4,  7)
+		SALSA_MULTI_STEP(11, 10,  9,  7) SALSA_MULTI_STEP(12, 15, 14,  7)
+
+		SALSA_MULTI_STEP( 2,  1,  0,  9) SALSA_MULTI_STEP( 7,  6,  5,  9)
+		SALSA_MULTI_STEP( 8, 11, 10,  9) SALSA_MULTI_STEP(13, 12, 15,  9)
+
+		SALSA_MULTI_STEP( 3,  2,  1, 13) SALSA_MULTI_STEP( 4,  7,  6, 13)
+		SALSA_MULTI_STEP( 9,  8, 11, 13) SALSA_MULTI_STEP(14, 13, 12, 13)
+
+		SALSA_MULTI_STEP( 0,  3,  2, 18) SALSA_MULTI_STEP( 5,  4,  7, 18)
+		SALSA_MULTI_STEP(10,  9,  8, 18) SALSA_MULTI_STEP(15, 14, 13, 18)
+	}
+	for (k = 0; k < 16; k++)
+		B[k] += x[k];
+}
+
+#undef SALSA_MULTI_STEP
+
+/* Lane l of V[32 * i + k] holds word k of state i of input l */
+template <typename V>
+static inline __attribute__((always_inline)) void scrypt_1024_1_1_256_sp_ways(const char * const *input, char * const *output, char *scratchpad)
+{
+	const unsigned int ways = sizeof(V) / sizeof(uint32_t);
+	uint8_t B[128];
+	V X[32];
+	V *W;
+	uint32_t i, j, k, l;
+
+	W = (V *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (l = 0; l < ways; l++) {
+		PBKDF2_SHA256((const uint8_t *)input[l], 80, (const uint8_t *)input[l], 80, 1, B, 128);
+		for (k = 0; k < 32; k++)
+			X[k][l] = le32dec(&B[4 * k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		memcpy(&W[i * 32], X, sizeof(X));
+		xor_salsa8_multi<V>(&X[0], &X[16]);
+		xor_salsa8_multi<V>(&X[16], &X[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		for (l = 0; l < ways; l++) {
+			j = 32 * (X[16][l] & 1023);
+			for (k = 0; k < 32; k++)
+				X[k][l] ^= W[j + k][l];
+		}
+		xor_salsa8_multi<V>(&X[0], &X[16]);
+		xor_salsa8_multi<V>(&X[16], &X[0]);
+	}
+
+	for (l = 0; l < ways; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[4 * k], X[k][l]);
+		PBKDF2_SHA256((const uint8_t *)input[l], 80, B, 128, 1, (uint8_t *)output[l], 32);
+	}
+}
+
+static void scrypt_1024_1_1_256_sp_4way(const char * const *input, char * const *output, char *scratchpad)
+{
+	scrypt_1024_1_1_256_sp_ways<scrypt_v4>(input, output, scratchpad);
+}
+
+#if defined(SCRYPT_MULTI_X86)
+__attribute__((target("avx2")))
+static void scrypt_1024_1_1_256_sp_8way_avx2(const char * const *input, char * const *output, char *scratchpad)
+{
+	scrypt_1024_1_1_256_sp_ways<scrypt_v8>(input, output, scratchpad);
+}
+
+/* AVX-512VL adds a native rotate, which is most of the Salsa20/8 work */
+__attribute__((target("avx512f,avx512vl")))
+static void scrypt_1024_1_1_256_sp_8way_avx512(const char * const *input, char * const *output, char *scratchpad)
+{
+	scrypt_1024_1_1_256_sp_ways<scrypt_v8>(input, output, scratchpad);
+}
+#endif
+#else
+/* Without vector extensions the lanes are simply hashed one after the other */
+static void scrypt_1024_1_1_256_sp_4way(const char * const *input, char * const *output, char *scratchpad)
+{
+	for (int l = 0; l < 4; l++)
+		scrypt_1024_1_1_256_sp_generic(input[l], output[l], scratchpad);
+}
+#endif
+
+static void (*scrypt_1024_1_1_256_sp_ways_detected)(const char * const *input, char * const *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_4way;
+static unsigned int scrypt_ways_detected = 4;
+static const char *scrypt_multi_impl_detected = "generic-4way";
+
+void scrypt_detect_multi()
+{
+#if defined(SCRYPT_MULTI_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512vl")) {
+		scrypt_1024_1_1_256_sp_ways_detected = &scrypt_1024_1_1_256_sp_8way_avx512;
+		scrypt_ways_detected = 8;
+		scrypt_multi_impl_detected = "avx512-8way";
+		return;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		scrypt_1024_1_1_256_sp_ways_detected = &scrypt_1024_1_1_256_sp_8way_avx2;
+		scrypt_ways_detected = 8;
+		scrypt_multi_impl_detected = "avx2-8way";
+		return;
+	}
+#endif
+	scrypt_1024_1_1_256_sp_ways_detected = &scrypt_1024_1_1_256_sp_4way;
+	scrypt_ways_detected = 4;
+	scrypt_multi_impl_detected = "generic-4way";
+}
+
+/* Run the detection once at startup, so that every caller gets the best kernel */
+static struct CScryptMultiInit {
+	CScryptMultiInit() { scrypt_detect_multi(); }
+} scrypt_multi_init;
+
+unsigned int scrypt_multi_ways()
+{
+	return scrypt_ways_detected;
+}
+
+const char *scrypt_multi_impl()
+{
+	return scrypt_multi_impl_detected;
+}
+
+void scrypt_1024_1_1_256_sp_multi(const char * const *inputs, char * const *outputs, unsigned int n, char *scratchpad)
+{
+	const unsigned int ways = scrypt_ways_detected;
+	unsigned int i, l;
+
+	for (i = 0; i + ways <= n; i += ways)
+		scrypt_1024_1_1_256_sp_ways_detected(&inputs[i], &outputs[i], scratchpad);
+
+	if (n - i == 1) {
+		scrypt_1024_1_1_256_sp_generic(inputs[i], outputs[i], scratchpad);
+	} else if (i < n) {
+		/* Fill the unused lanes with copies of the last input */
+		const char *input[SCRYPT_MAX_WAYS];
+		char *output[SCRYPT_MAX_WAYS];
+		char unused[SCRYPT_MAX_WAYS][32];
+		for (l = 0; l < ways; l++) {
+			input[l] = inputs[i + l < n ? i + l : n - 1];
+			output[l] = i + l < n ? outputs[i + l] : unused[l];
+		}
+		scrypt_1024_1_1_256_sp_ways_detected(input, output, scratchpad);
+	}
+}
@@ -8,6 +8,18 @@ static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/* Maximum number of inputs the multi-lane kernels hash at once */
+static const int SCRYPT_MAX_WAYS = 8;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = 131072 * SCRYPT_MAX_WAYS + 63;
+
+/* Select the multi-lane kernel for this CPU, done automatically at startup */
+void scrypt_detect_multi();
+/* Number of inputs the selected kernel hashes at once, and its name */
+unsigned int scrypt_multi_ways();
+const char *scrypt_multi_impl();
+/* Hash n 80-byte inputs, scratchpad must be SCRYPT_MULTI_SCRATCHPAD_SIZE bytes */
+void scrypt_1024_1_1_256_sp_multi(const char * const *inputs, char * const *outputs, unsigned int n, char *scratchpad);
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -0,0 +1,304 @@
+// Copyright (c) 2016 Jeremy Rubin
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Fixed-size cache with cuckoo-style placement, used for the signature cache.
+ *
+ * The table is allocated once by setup() and never grows. Each element has
+ * eight candidate slots, derived from eight independent 32-bit hashes.
+ */
+namespace CuckooCache
+{
+
+/**
+ * One atomic "may be overwritten" flag per slot, packed eight to a byte.
+ *
+ * Flags are set with relaxed ordering: they are only a hint to insert(),
+ * which tells contains() about its writes through a sequence counter.
+ * contains() may therefore mark a slot for collection without any lock.
+ */
+class bit_packed_atomic_flags
+{
+    std::unique_ptr<std::atomic<uint8_t>[]> mem;
+
+public:
+    bit_packed_atomic_flags() = delete;
+
+    /** All flags start set, so every slot is free to use */
+    explicit bit_packed_atomic_flags(uint32_t size)
+    {
+        // pad out the size if needed
+        size = (size + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            mem[i].store(0xFF);
+    }
+
+    /** Replace the flags with b set flags. Not thread-safe. */
+    void setup(uint32_t b)
+    {
+        bit_packed_atomic_flags d(b);
+        std::swap(mem, d.mem);
+    }
+
+    void bit_set(uint32_t s)
+    {
+        mem[s >> 3].fetch_or(1 << (s & 7), std::memory_order_relaxed);
+    }
+
+    void bit_unset(uint32_t s)
+    {
+        mem[s >> 3].fetch_and(~(1 << (s & 7)), std::memory_order_relaxed);
+    }
+
+    bool bit_is_set(uint32_t s) const
+    {
+        return (1 << (s & 7)) & mem[s >> 3].load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Cuckoo table of Elements with generation-based eviction.
+ *
+ * Hash must provide `template <uint8_t hash_select> uint32_t operator()(const Element&) const`
+ * for hash_select in 0..7, returning well distributed and independent values.
+ *
+ * Eviction works on two generations. Every slot remembers whether it was
+ * written in the current generation (epoch_flags). insert() periodically
+ * counts the live elements of the current generation; once they make up
+ * about 45% of the table, a new generation starts and every element of the
+ * old one is marked as collectable. Elements that are found with erase set
+ * are marked immediately. A collectable slot keeps its value until insert()
+ * needs it, so it can still produce a hit in the meantime.
+ *
+ * Thread safety: setup() needs exclusive access, and insert() calls must be
+ * serialized with each other. contains() takes no lock and may run during
+ * an insert(): it checks a sequence counter that insert() bumps before and
+ * after writing, and reports a miss if the table changed while it looked.
+ * A miss is always safe for a cache, a torn read never produces a hit.
+ */
+template <typename Element, typename Hash>
+class cache
+{
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+    static_assert(std::is_trivially_destructible<Element>::value, "slots are never destructed");
+    static_assert(CACHE_LINE_SIZE % sizeof(Element) == 0, "slots must not straddle cache lines");
+
+    /** The slots, starting at a cache line boundary in table_mem */
+    std::unique_ptr<char[]> table_mem;
+    Element* table;
+
+    /** Odd while insert() writes to the table, see contains() */
+    std::atomic<uint32_t> write_seq;
+
+    /** Number of slots in table */
+    uint32_t size;
+
+    /** Set if the slot may be overwritten by insert() */
+    mutable bit_packed_atomic_flags collection_flags;
+
+    /** Set if the slot was written in the current generation */
+    mutable std::vector<bool> epoch_flags;
+
+    /** Number of inserts before the size of the generation is checked again */
+    uint32_t epoch_heuristic_counter;
+
+    /** Number of live elements of the current generation that starts a new one */
+    uint32_t epoch_size;
+
+    /** Maximum number of displacements per insert, log2 of size */
+    uint8_t depth_limit;
+
+    const Hash hash_function;
+
+    /**
+     * Maps the eight hashes of e onto [0, size) without a division by
+     * taking the upper 32 bits of hash * size.
+     */
+    std::array<uint32_t, 8> compute_hashes(const Element& e) const
+    {
+        return {{(uint32_t)((hash_function.template operator()<0>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<1>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<2>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<3>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<4>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<5>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<6>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)((hash_function.template operator()<7>(e) * (uint64_t)size) >> 32)}};
+    }
+
+    static uint32_t invalid() { return ~(uint32_t)0; }
+
+    void allow_erase(uint32_t n) const { collection_flags.bit_set(n); }
+    void please_keep(uint32_t n) const { collection_flags.bit_unset(n); }
+
+    /** Makes write_seq odd while the table is being written */
+    class write_guard
+    {
+        std::atomic<uint32_t>& seq;
+
+    public:
+        explicit write_guard(std::atomic<uint32_t>& seqIn) : seq(seqIn)
+        {
+            seq.fetch_add(1, std::memory_order_relaxed);
+            // The writes to the table may not become visible before the odd count
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        ~write_guard() { seq.fetch_add(1, std::memory_order_release); }
+    };
+
+    /**
+     * Start a new generation if the current one is large enough. The count
+     * is a full scan, so it is only repeated after a number of inserts that
+     * could at best have filled the remainder of the generation.
+     */
+    void epoch_check()
+    {
+        if (epoch_heuristic_counter != 0) {
+            --epoch_heuristic_counter;
+            return;
+        }
+
+        uint32_t epoch_unused_count = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            epoch_unused_count += epoch_flags[i] && !collection_flags.bit_is_set(i);
+
+        if (epoch_unused_count >= epoch_size) {
+            for (uint32_t i = 0; i < size; ++i) {
+                if (epoch_flags[i])
+                    epoch_flags[i] = false;
+                else
+                    allow_erase(i);
+            }
+            epoch_heuristic_counter = epoch_size;
+        } else {
+            epoch_heuristic_counter = std::max(1u, std::max(epoch_size / 16,
+                        epoch_size - std::min(epoch_size, epoch_unused_count)));
+        }
+    }
+
+public:
+    cache() : table_mem(), table(NULL), write_seq(0), size(), collection_flags(0), epoch_flags(),
+              epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    {
+    }
+
+    /**
+     * Allocate room for new_size elements (at least 2), discarding the
+     * current contents. Returns the number of slots.
+     */
+    uint32_t setup(uint32_t new_size)
+    {
+        size = std::max<uint32_t>(2, new_size);
+        depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(size)));
+        table_mem.reset(new char[size * sizeof(Element) + CACHE_LINE_SIZE - 1]);
+        table = reinterpret_cast<Element*>((reinterpret_cast<uintptr_t>(table_mem.get()) + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+        for (uint32_t i = 0; i < size; ++i)
+            new (&table[i]) Element();
+        collection_flags.setup(size);
+        epoch_flags.assign(size, false);
+        epoch_size = std::max<uint32_t>(1, (45 * (uint64_t)size) / 100);
+        epoch_heuristic_counter = epoch_size;
+        return size;
+    }
+
+    /** Like setup(), but sized to use at most bytes of memory for the elements */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        return setup(std::min<size_t>(bytes / sizeof(Element), ~(uint32_t)0));
+    }
+
+    /**
+     * Insert e, first into a free or collectable candidate slot. If there is
+     * none, e takes the place of one of its candidates and the displaced
+     * element moves on to one of its own, at most depth_limit times. An
+     * element still displaced after that is dropped, which is fine for a
+     * cache. Inserting an element that is already present refreshes it.
+     */
+    void insert(Element e)
+    {
+        write_guard guard(write_seq);
+        epoch_check();
+        uint32_t last_loc = invalid();
+        bool last_epoch = true;
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+
+        for (const uint32_t loc : locs) {
+            if (table[loc] == e) {
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+        }
+
+        for (uint8_t depth = 0; depth < depth_limit; ++depth) {
+            for (const uint32_t loc : locs) {
+                if (!collection_flags.bit_is_set(loc))
+                    continue;
+                table[loc] = std::move(e);
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+
+            // Displace the candidate after the slot we arrived in, so an
+            // element is never swapped straight back to where it came from
+            last_loc = locs[(1 + (std::find(locs.begin(), locs.end(), last_loc) - locs.begin())) & 7];
+            std::swap(table[last_loc], e);
+            bool epoch = last_epoch;
+            last_epoch = epoch_flags[last_loc];
+            epoch_flags[last_loc] = epoch;
+
+            locs = compute_hashes(e);
+        }
+    }
+
+    /**
+     * Check whether e is in the table. With erase set a hit is marked as
+     * collectable; the value itself stays until insert() reuses the slot.
+     * Misses while an insert() is running.
+     */
+    bool contains(const Element& e, const bool erase) const
+    {
+        uint32_t seq = write_seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            return false;
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+        uint32_t found = invalid();
+        for (const uint32_t loc : locs) {
+            if (table[loc] == e) {
+                found = loc;
+                break;
+            }
+        }
+        // The reads of the table may not be moved past the second look at the count
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (found == invalid() || write_seq.load(std::memory_order_relaxed) != seq)
+            return false;
+        // Should an insert() have reused the slot by now, this only makes
+        // the new element collectable early
+        if (erase)
+            allow_erase(found);
+        return true;
+    }
+};
+
+} // namespace CuckooCache
+
+#endif // BITCOIN_CUCKOOCACHE_H
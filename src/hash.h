@@ -204,5 +204,14 @@ public:
  *      .Finalize()
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+/** Same as SipHashUint256, followed by a 32-bit value (e.g. an output index):
+ *    SipHasher(k0, k1)
+ *      .Write(val.GetUint64(0))
+ *      ...
+ *      .Write(val.GetUint64(3))
+ *      .Write(extra) as 4 bytes
+ *      .Finalize()
+ */
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
 #endif // BITCOIN_HASH_H
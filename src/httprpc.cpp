@@ -7,6 +7,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "jsonwriter.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -19,6 +20,7 @@
 #include "utilstrencodings.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
@@ -68,6 +70,13 @@ static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
+    // A reply that is already going out can only be cut off
+    if (req->IsChunkedReplyStarted()) {
+        LogPrint("rpc", "Failed to finish reply: %s\n", objError.write());
+        req->EndChunkedReply(false);
+        return;
+    }
+
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
@@ -83,6 +92,24 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+bool WriteJSONReplyChunk(HTTPRequest* req, const std::string& strChunk)
+{
+    if (!req->IsChunkedReplyStarted())
+        req->WriteHeader("Content-Type", "application/json");
+    return req->WriteReplyChunk(strChunk);
+}
+
+void EndJSONReply(HTTPRequest* req, CJSONWriter& writer)
+{
+    if (!req->IsChunkedReplyStarted()) {
+        // It all fit in one chunk
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, writer.GetPending());
+        return;
+    }
+    req->EndChunkedReply(writer.Flush());
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -184,6 +211,19 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Large results are sent while they are being written
+            CJSONWriter writer(boost::bind(WriteJSONReplyChunk, req, _1));
+            writer.BeginObject();
+            writer.Key("result");
+            if (tableRPC.executeStream(jreq.strMethod, jreq.params, writer)) {
+                writer.Write("error", NullUniValue);
+                writer.Write("id", jreq.id);
+                writer.EndObject();
+                writer.WriteRaw("\n");
+                EndJSONReply(req, writer);
+                return true;
+            }
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -191,7 +231,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), &QueueHTTPWork);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
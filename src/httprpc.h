@@ -8,6 +8,7 @@
 #include <string>
 #include <map>
 
+class CJSONWriter;
 class HTTPRequest;
 
 /** Start HTTP RPC subsystem.
@@ -34,4 +35,9 @@ void InterruptREST();
  */
 void StopREST();
 
+/** CJSONWriter sink sending the output as application/json reply to req */
+bool WriteJSONReplyChunk(HTTPRequest* req, const std::string& strChunk);
+/** Send the rest of the output of writer and finish the reply to req */
+void EndJSONReply(HTTPRequest* req, CJSONWriter& writer);
+
 #endif
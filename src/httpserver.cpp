@@ -20,8 +20,10 @@
 #include <sys/stat.h>
 #include <signal.h>
 
+#include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/http.h>
+#include <event2/listener.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
 #include <event2/util.h>
@@ -40,17 +42,30 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+//! Statistics of the HTTP server, see GetHTTPStats
+static CCriticalSection cs_httpStats;
+static HTTPStats httpStats;
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
 public:
     HTTPWorkItem(std::unique_ptr<HTTPRequest> req, const std::string &path, const HTTPRequestHandler& func):
-        req(std::move(req)), path(path), func(func)
+        req(std::move(req)), path(path), func(func), nTimeQueued(GetTimeMicros())
     {
     }
     void operator()()
     {
+        int64_t nTimeStart = GetTimeMicros();
         func(req.get(), path);
+        int64_t nTimeDone = GetTimeMicros();
+
+        LOCK(cs_httpStats);
+        httpStats.nRequests++;
+        httpStats.nTotalQueueTime += nTimeStart - nTimeQueued;
+        httpStats.nMaxQueueTime = std::max(httpStats.nMaxQueueTime, nTimeStart - nTimeQueued);
+        httpStats.nTotalHandleTime += nTimeDone - nTimeStart;
+        httpStats.nMaxHandleTime = std::max(httpStats.nMaxHandleTime, nTimeDone - nTimeStart);
     }
 
     std::unique_ptr<HTTPRequest> req;
@@ -58,6 +73,23 @@ public:
 private:
     std::string path;
     HTTPRequestHandler func;
+    int64_t nTimeQueued;
+};
+
+/** Work item for other work than handling a request */
+class HTTPFunctionWorkItem : public HTTPClosure
+{
+public:
+    HTTPFunctionWorkItem(const boost::function<void(void)>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
 };
 
 /** Simple work queue for distributing work over multiple threads.
@@ -73,6 +105,7 @@ private:
     std::deque<std::unique_ptr<WorkItem>> queue;
     bool running;
     size_t maxDepth;
+    size_t peakDepth;
     int numThreads;
 
     /** RAII object to keep track of number of running worker threads */
@@ -96,6 +129,7 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
+                                 peakDepth(0),
                                  numThreads(0)
     {
     }
@@ -113,6 +147,7 @@ public:
             return false;
         }
         queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        peakDepth = std::max(peakDepth, queue.size());
         cond.notify_one();
         return true;
     }
@@ -155,6 +190,18 @@ public:
         boost::unique_lock<boost::mutex> lock(cs);
         return queue.size();
     }
+
+    /** Return maximum and highest reached depth of queue */
+    size_t MaxDepth()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return maxDepth;
+    }
+    size_t PeakDepth()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return peakDepth;
+    }
 };
 
 struct HTTPPathHandler
@@ -169,20 +216,30 @@ struct HTTPPathHandler
     HTTPRequestHandler handler;
 };
 
+/** An event loop with its own HTTP server and listening sockets. With more
+ * than one, they all listen on the same addresses (SO_REUSEPORT) and the
+ * kernel spreads the incoming connections over them.
+ */
+struct HTTPEventLoop
+{
+    HTTPEventLoop() : id(0), base(0), http(0) {}
+    int id;
+    struct event_base* base;
+    struct evhttp* http;
+    std::vector<evhttp_bound_socket *> boundSockets;
+    boost::thread thread;
+};
+
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops; the first one also runs timers and custom events, see EventBase()
+static std::vector<HTTPEventLoop*> eventLoops;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -242,10 +299,34 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** Send replies on the connection of req right away. Otherwise the reply to
+ * a pipelined request waits for the client to acknowledge the previous one. */
+static void SetNoDelay(struct evhttp_request* req)
+{
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    struct bufferevent* bev = con ? evhttp_connection_get_bufferevent(con) : NULL;
+    evutil_socket_t fd = bev ? bufferevent_getfd(bev) : -1;
+    if (fd == -1)
+        return;
+    int set = 1;
+#ifdef WIN32
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&set, sizeof(int));
+#else
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&set, sizeof(int));
+#endif
+#endif
+}
+
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
     std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    {
+        LOCK(cs_httpStats);
+        httpStats.vEventThreadRequests[((HTTPEventLoop*)arg)->id]++;
+    }
+    SetNoDelay(req);
 
     LogPrint("http", "Received a %s request for %s from %s\n",
              RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
@@ -288,6 +369,8 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
         else {
             LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+            LOCK(cs_httpStats);
+            httpStats.nRejected++;
         }
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
@@ -302,22 +385,85 @@ static void http_reject_request_cb(struct evhttp_request* req, void*)
 }
 
 /** Event dispatcher thread */
-static void ThreadHTTP(struct event_base* base, struct evhttp* http)
+static void ThreadHTTP(HTTPEventLoop* loop)
 {
-    RenameThread("egulden-http");
-    LogPrint("http", "Entering http event loop\n");
-    event_base_dispatch(base);
+    RenameThread(loop->id == 0 ? "egulden-http" : strprintf("egulden-http-%d", loop->id).c_str());
+    LogPrint("http", "Entering http event loop %d\n", loop->id);
+    event_base_dispatch(loop->base);
     // Event loop will be interrupted by InterruptHTTPServer()
-    LogPrint("http", "Exited http event loop\n");
+    LogPrint("http", "Exited http event loop %d\n", loop->id);
+}
+
+#if defined(LEV_OPT_REUSEABLE_PORT) && !defined(WIN32)
+/** Whether nothing listens on the address yet: a bind without SO_REUSEPORT succeeds */
+static bool HTTPAddressFree(const CService& addrBind, const struct sockaddr* sockaddr, socklen_t len)
+{
+    SOCKET hSocket = socket(sockaddr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (hSocket == INVALID_SOCKET)
+        return true; // let the real bind report the problem
+    int nOne = 1;
+    // Like the listener: ignore connections in TIME_WAIT, and IPv4 for IPv6 addresses
+    setsockopt(hSocket, SOL_SOCKET, SO_REUSEADDR, (void*)&nOne, sizeof(int));
+#ifdef IPV6_V6ONLY
+    if (addrBind.IsIPv6())
+        setsockopt(hSocket, IPPROTO_IPV6, IPV6_V6ONLY, (void*)&nOne, sizeof(int));
+#endif
+    bool fFree = bind(hSocket, sockaddr, len) != SOCKET_ERROR;
+    CloseSocket(hSocket);
+    return fFree;
 }
+#endif
 
-/** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+/**
+ * Bind a listening socket for loop's HTTP server. With fReusePort the first
+ * event loop binds addresses that nothing listens on yet, and the others
+ * share them.
+ */
+static evhttp_bound_socket* HTTPBindAddress(HTTPEventLoop* loop, const std::string& host, uint16_t port, bool fReusePort)
+{
+    CService addrBind;
+    if (!Lookup(host.empty() ? "::" : host.c_str(), addrBind, port, true))
+        return NULL;
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+        return NULL;
+
+    unsigned int flags = LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC;
+#ifdef LEV_OPT_REUSEABLE_PORT
+    if (fReusePort) {
+#ifndef WIN32
+        // SO_REUSEPORT would also let the bind succeed next to another
+        // process listening with it, e.g. a second node on the same port,
+        // and the kernel would silently split the connections between us.
+        if (loop->id == 0 && !HTTPAddressFree(addrBind, (struct sockaddr*)&sockaddr, len)) {
+            LogPrintf("HTTP: address %s is in use already\n", addrBind.ToString());
+            return NULL;
+        }
+#endif
+        flags |= LEV_OPT_REUSEABLE_PORT;
+    }
+#endif
+#ifdef LEV_OPT_BIND_IPV6ONLY
+    // Leave IPv4 to its own listening socket
+    if (addrBind.IsIPv6())
+        flags |= LEV_OPT_BIND_IPV6ONLY;
+#endif
+    struct evconnlistener* listener = evconnlistener_new_bind(loop->base, NULL, NULL, flags, -1, (struct sockaddr*)&sockaddr, len);
+    if (!listener)
+        return NULL;
+    // The HTTP server takes over the listener
+    evhttp_bound_socket* bind_handle = evhttp_bind_listener(loop->http, listener);
+    if (!bind_handle)
+        evconnlistener_free(listener);
+    return bind_handle;
+}
+
+/** Determine what addresses to bind to */
+static void HTTPBindEndpoints(std::vector<std::pair<std::string, uint16_t> >& endpoints)
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
-    std::vector<std::pair<std::string, uint16_t> > endpoints;
 
-    // Determine what addresses to bind to
     if (!mapArgs.count("-rpcallowip")) { // Default to loopback if not allowing external IPs
         endpoints.push_back(std::make_pair("::1", defaultPort));
         endpoints.push_back(std::make_pair("127.0.0.1", defaultPort));
@@ -336,18 +482,61 @@ static bool HTTPBindAddresses(struct evhttp* http)
         endpoints.push_back(std::make_pair("::", defaultPort));
         endpoints.push_back(std::make_pair("0.0.0.0", defaultPort));
     }
+}
 
-    // Bind addresses
-    for (std::vector<std::pair<std::string, uint16_t> >::iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
-        LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
-        evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
+/**
+ * Bind loop's HTTP server to the endpoints. Those that fail are dropped, so
+ * the event loops after the first only share the addresses it got.
+ */
+static bool HTTPBindAddresses(HTTPEventLoop* loop, std::vector<std::pair<std::string, uint16_t> >& endpoints, bool fReusePort)
+{
+    for (std::vector<std::pair<std::string, uint16_t> >::iterator i = endpoints.begin(); i != endpoints.end(); ) {
+        LogPrint("http", "Binding RPC on address %s port %i (event loop %d)\n", i->first, i->second, loop->id);
+        evhttp_bound_socket *bind_handle = HTTPBindAddress(loop, i->first, i->second, fReusePort);
         if (bind_handle) {
-            boundSockets.push_back(bind_handle);
+            loop->boundSockets.push_back(bind_handle);
+            ++i;
         } else {
             LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
+            i = endpoints.erase(i);
         }
     }
-    return !boundSockets.empty();
+    return !loop->boundSockets.empty();
+}
+
+/** Create an event loop with an HTTP server, NULL on failure */
+static HTTPEventLoop* NewHTTPEventLoop(int id)
+{
+    HTTPEventLoop* loop = new HTTPEventLoop();
+    loop->id = id;
+    loop->base = event_base_new();
+    if (!loop->base) {
+        LogPrintf("Couldn't create an event_base: exiting\n");
+        delete loop;
+        return NULL;
+    }
+
+    /* Create a new evhttp object to handle requests. */
+    loop->http = evhttp_new(loop->base);
+    if (!loop->http) {
+        LogPrintf("couldn't create evhttp. Exiting.\n");
+        event_base_free(loop->base);
+        delete loop;
+        return NULL;
+    }
+
+    evhttp_set_timeout(loop->http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    evhttp_set_max_headers_size(loop->http, MAX_HEADERS_SIZE);
+    evhttp_set_max_body_size(loop->http, MAX_SIZE);
+    evhttp_set_gencb(loop->http, http_request_cb, loop);
+    return loop;
+}
+
+static void FreeHTTPEventLoop(HTTPEventLoop* loop)
+{
+    evhttp_free(loop->http);
+    event_base_free(loop->base);
+    delete loop;
 }
 
 /** Simple wrapper to set thread name and run work queue */
@@ -372,9 +561,6 @@ static void libevent_log_cb(int severity, const char *msg)
 
 bool InitHTTPServer()
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
-
     if (!InitHTTPAllowList())
         return false;
 
@@ -401,50 +587,53 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
-        return false;
+    int nEventThreads = std::max(std::min((int)GetArg("-rpceventthreads", DEFAULT_HTTP_EVENT_THREADS), MAX_HTTP_EVENT_THREADS), 1);
+#ifndef LEV_OPT_REUSEABLE_PORT
+    if (nEventThreads > 1) {
+        LogPrintf("HTTP: -rpceventthreads needs a libevent with SO_REUSEPORT support, using one event thread\n");
+        nEventThreads = 1;
     }
+#endif
 
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
+    std::vector<std::pair<std::string, uint16_t> > endpoints;
+    HTTPBindEndpoints(endpoints);
+    for (int i = 0; i < nEventThreads; i++) {
+        HTTPEventLoop* loop = NewHTTPEventLoop(i);
+        if (!loop)
+            break;
+        if (!HTTPBindAddresses(loop, endpoints, nEventThreads > 1)) {
+            FreeHTTPEventLoop(loop);
+            if (i == 0)
+                LogPrintf("Unable to bind any endpoint for RPC server\n");
+            break;
+        }
+        eventLoops.push_back(loop);
     }
-
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
-
-    if (!HTTPBindAddresses(http)) {
-        LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
+    if (eventLoops.empty())
         return false;
-    }
+    if ((int)eventLoops.size() < nEventThreads)
+        LogPrintf("HTTP: only %u of %d event loops could listen, continuing with those\n", eventLoops.size(), nEventThreads);
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
+    {
+        LOCK(cs_httpStats);
+        httpStats = HTTPStats();
+        httpStats.vEventThreadRequests.resize(eventLoops.size());
+    }
     return true;
 }
 
-boost::thread threadHTTP;
-
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
     int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    LogPrintf("HTTP: starting %u event threads and %d worker threads\n", eventLoops.size(), rpcThreads);
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops)
+        loop->thread = boost::thread(boost::bind(&ThreadHTTP, loop));
 
     for (int i = 0; i < rpcThreads; i++)
         boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
@@ -454,13 +643,14 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
         // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets) {
+            evhttp_del_accept_socket(loop->http, socket);
         }
+        loop->boundSockets.clear();
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(loop->http, http_reject_request_cb, NULL);
     }
     if (workQueue)
         workQueue->Interrupt();
@@ -473,9 +663,10 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
+        workQueue = 0;
     }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
+        LogPrint("http", "Waiting for HTTP event thread %d to exit\n", loop->id);
         // Give event loop a few seconds to exit (to send back last RPC responses), then break it
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
         // at least libevent 2.0.21 and always introduced a delay. In libevent
@@ -483,29 +674,51 @@ void StopHTTPServer()
         // could be used again (if desirable).
         // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
 #if BOOST_VERSION >= 105000
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
+        if (!loop->thread.try_join_for(boost::chrono::milliseconds(2000))) {
 #else
-        if (!threadHTTP.timed_join(boost::posix_time::milliseconds(2000))) {
+        if (!loop->thread.timed_join(boost::posix_time::milliseconds(2000))) {
 #endif
             LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+            event_base_loopbreak(loop->base);
+            loop->thread.join();
         }
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops)
+        FreeHTTPEventLoop(loop);
+    eventLoops.clear();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
+bool QueueHTTPWork(const boost::function<void(void)>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionWorkItem> item(new HTTPFunctionWorkItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventLoops.empty() ? 0 : eventLoops[0]->base;
+}
+
+HTTPStats GetHTTPStats()
+{
+    HTTPStats stats;
+    {
+        LOCK(cs_httpStats);
+        stats = httpStats;
+    }
+    stats.nEventThreads = eventLoops.size();
+    if (workQueue) {
+        stats.nWorkQueueDepth = workQueue->Depth();
+        stats.nWorkQueueMaxDepth = workQueue->MaxDepth();
+        stats.nWorkQueuePeakDepth = workQueue->PeakDepth();
+    }
+    return stats;
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -534,13 +747,107 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
+
+/** Progress of a reply sent with HTTPRequest::WriteReplyChunk, shared by the
+ * worker writing it and the event thread sending it. */
+struct HTTPReplyChunks
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The last chunk handed to the event thread is not written to the connection yet
+    bool fSending;
+    //! The connection went away
+    bool fClosed;
+    //! How long a chunk may take to be sent, so stalled clients cannot hold a worker for long
+    int64_t nTimeout;
+
+    HTTPReplyChunks() : fSending(false), fClosed(false),
+        nTimeout(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT)) {}
+
+    void SetSent(bool fClosedIn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fSending = false;
+        fClosed |= fClosedIn;
+        cond.notify_all();
+    }
+
+    /** Wait until the last chunk was sent. Like evhttp does for the rest of
+     * a request, a client that takes nothing for nTimeout seconds is given up
+     * on; one that reads slowly but steadily gets the whole reply.
+     * Returns false if the connection is gone. */
+    bool WaitSent(boost::unique_lock<boost::mutex>& lock)
+    {
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::seconds(nTimeout);
+        while (fSending && !fClosed) {
+            if (!cond.timed_wait(lock, deadline)) {
+                LogPrintf("HTTP: dropping a reply whose client took nothing for %d seconds\n", nTimeout);
+                fClosed = true;
+            }
+        }
+        return !fClosed;
+    }
+};
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+static void http_reply_chunk_written_cb(struct evhttp_connection*, void* arg)
+{
+    ((HTTPReplyChunks*)arg)->SetSent(false);
+}
+
+static void http_reply_chunk_closed_cb(struct evhttp_connection*, void* arg)
+{
+    ((HTTPReplyChunks*)arg)->SetSent(true);
+}
+
+/** Send a chunk of a reply, from the event thread. The first one starts the reply. */
+static void http_send_reply_chunk(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<HTTPReplyChunks> chunks, bool fStart)
+{
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    if (!con) {
+        // The client went away before we were done
+        chunks->SetSent(true);
+    } else {
+        if (fStart) {
+            evhttp_connection_set_closecb(con, http_reply_chunk_closed_cb, chunks.get());
+            evhttp_send_reply_start(req, HTTP_OK, NULL);
+        }
+        if (evbuffer_get_length(evb) == 0 || evhttp_request_get_command(req) == EVHTTP_REQ_HEAD) {
+            // Nothing is sent, so there is nothing to wait for
+            chunks->SetSent(false);
+        } else {
+            evhttp_send_reply_chunk_with_cb(req, evb, http_reply_chunk_written_cb, chunks.get());
+        }
+    }
+    evbuffer_free(evb);
+}
+
+static void http_send_reply_end(struct evhttp_request* req, std::shared_ptr<HTTPReplyChunks> chunks, bool fComplete)
+{
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    if (con)
+        evhttp_connection_set_closecb(con, NULL, NULL);
+    if (con && !fComplete)
+        evhttp_connection_free(con); // frees req as well
+    else
+        evhttp_send_reply_end(req);
+}
+#endif
+
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
                                                        replySent(false)
 {
+    // Replies go back through the event loop of the connection
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    base = con ? evhttp_connection_get_base(con) : EventBase();
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunks) {
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        EndChunkedReply(false);
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -598,13 +905,69 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+    HTTPEvent* ev = new HTTPEvent(base, true,
         boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
     replySent = true;
     req = 0; // transferred back to main thread
 }
 
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && req);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    bool fStart = !chunks;
+    if (fStart)
+        chunks.reset(new HTTPReplyChunks());
+    {
+        boost::unique_lock<boost::mutex> lock(chunks->mutex);
+        if (!chunks->WaitSent(lock))
+            return false;
+        if (strChunk.empty() && !fStart)
+            return true;
+        chunks->fSending = true;
+    }
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(base, true, boost::bind(http_send_reply_chunk, req, evb, chunks, fStart));
+    ev->trigger(0);
+#else
+    // Without write callbacks there is no telling when a chunk was sent, so
+    // collect the reply and send it at the end
+    if (!chunks)
+        chunks.reset(new HTTPReplyChunks());
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+#endif
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply(bool fComplete)
+{
+    assert(!replySent && req && chunks);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    if (fComplete) {
+        // Let the last chunk go out first
+        boost::unique_lock<boost::mutex> lock(chunks->mutex);
+        fComplete = chunks->WaitSent(lock);
+    }
+    HTTPEvent* ev = new HTTPEvent(base, true, boost::bind(http_send_reply_end, req, chunks, fComplete));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+#else
+    if (!fComplete) {
+        struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+        WriteReply(HTTP_INTERNAL, "Reply failed");
+        return;
+    }
+    WriteReply(HTTP_OK);
+#endif
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
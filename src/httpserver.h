@@ -5,8 +5,10 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
+#include <vector>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
@@ -14,11 +16,14 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const int DEFAULT_HTTP_EVENT_THREADS=1;
+static const int MAX_HTTP_EVENT_THREADS=16;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyChunks;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -49,6 +54,35 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Run func on one of the threads that handle requests. Returns false if the
+ * work queue is full or the server is not running.
+ */
+bool QueueHTTPWork(const boost::function<void(void)>& func);
+
+/** HTTP server statistics, times in microseconds */
+struct HTTPStats
+{
+    HTTPStats() : nEventThreads(0), nWorkQueueDepth(0), nWorkQueueMaxDepth(0), nWorkQueuePeakDepth(0),
+                  nRequests(0), nRejected(0), nTotalQueueTime(0), nMaxQueueTime(0), nTotalHandleTime(0), nMaxHandleTime(0) {}
+    int nEventThreads;
+    size_t nWorkQueueDepth;
+    size_t nWorkQueueMaxDepth;
+    size_t nWorkQueuePeakDepth;
+    //! Requests handled by the worker threads, and turned away because the work queue was full
+    uint64_t nRequests;
+    uint64_t nRejected;
+    //! Time spent in the work queue, and in the handler
+    int64_t nTotalQueueTime;
+    int64_t nMaxQueueTime;
+    int64_t nTotalHandleTime;
+    int64_t nMaxHandleTime;
+    //! Requests received by each event thread
+    std::vector<uint64_t> vEventThreadRequests;
+};
+
+/** Return statistics of the HTTP server */
+HTTPStats GetHTTPStats();
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,7 +90,10 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    struct event_base* base;
     bool replySent;
+    //! Set once a reply is being sent with WriteReplyChunk
+    std::shared_ptr<HTTPReplyChunks> chunks;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -112,6 +149,28 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write the next part of a HTTP_OK reply whose length is not known up
+     * front. The first call sends the headers; HTTP/1.1 clients get the body
+     * with chunked transfer encoding. Waits while the previous part is still
+     * being sent, so a slow client holds up the writer instead of filling up
+     * memory. Each part must be sent within -rpcservertimeout seconds.
+     * Returns false if the client went away or stopped reading.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /** Whether a reply was started with WriteReplyChunk */
+    bool IsChunkedReplyStarted() const { return chunks != NULL; }
+
+    /**
+     * Finish a reply started with WriteReplyChunk. If fComplete is false the
+     * connection is closed instead, so the client cannot take what it got for
+     * the whole reply.
+     *
+     * @note Like WriteReply, do not call any other HTTPRequest methods after calling this.
+     */
+    void EndChunkedReply(bool fComplete = true);
 };
 
 /** Event handler closure.
@@ -0,0 +1,144 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexsnapshot.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "streams.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+
+/** Identifies the file format, bump when changing it */
+static const uint32_t BLOCKINDEX_SNAPSHOT_MAGIC = 0x78646962; // "bidx"
+static const int BLOCKINDEX_SNAPSHOT_VERSION = 1;
+
+namespace {
+
+struct CompareBlockIndexHeight
+{
+    bool operator()(const CBlockIndex* a, const CBlockIndex* b) const
+    {
+        return a->nHeight < b->nHeight;
+    }
+};
+
+}
+
+bool WriteBlockIndexSnapshot(const boost::filesystem::path& path, const uint256& hashBestBlock, const std::vector<CBlockIndex*>& vIndex)
+{
+    std::vector<CBlockIndex*> vSorted(vIndex);
+    std::sort(vSorted.begin(), vSorted.end(), CompareBlockIndexHeight());
+
+    CDataStream ssSnapshot(SER_DISK, CLIENT_VERSION);
+    ssSnapshot << BLOCKINDEX_SNAPSHOT_MAGIC << BLOCKINDEX_SNAPSHOT_VERSION << hashBestBlock << (uint64_t)vSorted.size();
+    for (std::vector<CBlockIndex*>::const_iterator it = vSorted.begin(); it != vSorted.end(); ++it) {
+        const CBlockIndex* pindex = *it;
+        ssSnapshot << pindex->GetBlockHash() << CDiskBlockIndex(pindex) << ArithToUint256(pindex->nChainWork);
+    }
+    ssSnapshot << Hash(ssSnapshot.begin(), ssSnapshot.end());
+
+    // Write to a temporary file and move it in place, so that a partially
+    // written snapshot is never picked up
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    if (fwrite(&ssSnapshot[0], 1, ssSnapshot.size(), file) != ssSnapshot.size()) {
+        fclose(file);
+        return error("%s: failed to write %s", __func__, pathTmp.string());
+    }
+    FileCommit(file);
+    fclose(file);
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s: rename to %s failed", __func__, path.string());
+
+    return true;
+}
+
+bool LoadBlockIndexSnapshot(const boost::filesystem::path& path, const uint256& hashBestBlock,
+                            boost::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                            std::vector<CBlockIndex*>& vSortedByHeight)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return false;
+
+    uint64_t nSize = 0;
+    try {
+        nSize = boost::filesystem::file_size(path);
+    } catch (const boost::filesystem::filesystem_error&) {}
+
+    CDataStream ssSnapshot(SER_DISK, CLIENT_VERSION);
+    ssSnapshot.resize(nSize);
+    size_t nRead = nSize > 0 ? fread(&ssSnapshot[0], 1, nSize, file) : 0;
+    fclose(file);
+    if (nRead != nSize || nSize < sizeof(uint256))
+        return error("%s: failed to read %s", __func__, path.string());
+
+    // Check the checksum before looking at anything else
+    uint256 hashChecksum;
+    memcpy(hashChecksum.begin(), &ssSnapshot[nSize - sizeof(uint256)], sizeof(uint256));
+    if (Hash(ssSnapshot.begin(), ssSnapshot.end() - sizeof(uint256)) != hashChecksum)
+        return error("%s: checksum mismatch", __func__);
+    ssSnapshot.resize(nSize - sizeof(uint256));
+
+    try {
+        uint32_t nMagic;
+        int nVersion;
+        uint256 hashSnapshotBestBlock;
+        uint64_t nCount;
+        ssSnapshot >> nMagic >> nVersion >> hashSnapshotBestBlock >> nCount;
+        if (nMagic != BLOCKINDEX_SNAPSHOT_MAGIC || nVersion != BLOCKINDEX_SNAPSHOT_VERSION)
+            return error("%s: unknown format", __func__);
+        if (hashSnapshotBestBlock != hashBestBlock)
+            return error("%s: written at block %s, chainstate is at %s", __func__, hashSnapshotBestBlock.ToString(), hashBestBlock.ToString());
+
+        vSortedByHeight.clear();
+        vSortedByHeight.reserve(nCount);
+        for (uint64_t i = 0; i < nCount; i++) {
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            uint256 nChainWork;
+            ssSnapshot >> hash >> diskindex >> nChainWork;
+
+            // Construct block index object
+            CBlockIndex* pindexNew    = insertBlockIndex(hash);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nChainWork     = UintToArith256(nChainWork);
+
+            // Entries are in height order, so the parent has been loaded already
+            if (pindexNew->pprev && pindexNew->pprev->nHeight != pindexNew->nHeight - 1)
+                return error("%s: entry %s is out of order", __func__, hash.ToString());
+
+            vSortedByHeight.push_back(pindexNew);
+        }
+        if (!ssSnapshot.empty())
+            return error("%s: trailing data", __func__);
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
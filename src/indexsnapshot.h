@@ -0,0 +1,40 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXSNAPSHOT_H
+#define BITCOIN_INDEXSNAPSHOT_H
+
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+
+class CBlockIndex;
+class uint256;
+
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = false;
+
+/**
+ * Flat snapshot of the block index, written on clean shutdown so that the
+ * next startup can load it with one sequential read instead of scanning
+ * every entry of the block tree database and sorting them by height.
+ *
+ * Entries are stored in height order together with their hash and chain
+ * work, followed by a checksum of the whole file. A snapshot is only used
+ * if the checksum matches and it was written at the chainstate's current
+ * best block.
+ */
+bool WriteBlockIndexSnapshot(const boost::filesystem::path& path, const uint256& hashBestBlock, const std::vector<CBlockIndex*>& vIndex);
+
+/**
+ * Load a snapshot written by WriteBlockIndexSnapshot. The file is fully read
+ * and checked before insertBlockIndex is called. On success vSortedByHeight
+ * holds the loaded entries, ordered by height, with nChainWork filled in.
+ */
+bool LoadBlockIndexSnapshot(const boost::filesystem::path& path, const uint256& hashBestBlock,
+                            boost::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+                            std::vector<CBlockIndex*>& vSortedByHeight);
+
+#endif // BITCOIN_INDEXSNAPSHOT_H
@@ -16,13 +16,18 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "indexsnapshot.h"
 #include "key.h"
 #include "main.h"
+#include "mappedfile.h"
 #include "miner.h"
 #include "net.h"
+#include "netpoll.h"
 #include "oerushield/oerudb.h"
+#include "oerushield/oerushield.h"
 #include "oerushield/oerusignal.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
@@ -145,9 +150,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -172,6 +177,7 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    COeruSignal::InterruptOeruSignal();
     threadGroup.interrupt_all();
 }
 
@@ -190,13 +196,12 @@ void Shutdown()
     RenameThread("egulden-shutoff");
     mempool.AddTransactionsUpdated(1);
 
-    // Write oeru DB data
-    poeruDBMain->WriteFile();
-
     StopHTTPRPC();
     StopREST();
     StopRPC();
     StopHTTPServer();
+    StopBlockTemplateUpdater();
+    COeruSignal::StopOeruSignal();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
@@ -220,15 +225,21 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT))
+                DumpBlockIndexSnapshot();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsflusher;
+        pcoinsflusher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete poeruDBMain;
+        poeruDBMain = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -310,6 +321,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf(_("Write a snapshot of the block index on shutdown and load it on the next startup (default: %u)"), DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -330,8 +342,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-mmapblockfiles=<n>", strprintf(_("Keep up to <n> finished block and undo files memory-mapped for reading (0 = off, default: %u)"), DEFAULT_MMAP_BLOCK_FILES));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parheaders=<n>", strprintf(_("Set the number of header proof-of-work verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_HEADERCHECK_THREADS, DEFAULT_HEADERCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parprefetch=<n>", strprintf(_("Set the number of threads reading block inputs from the coins database ahead of validation (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -364,6 +381,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
+    strUsage += HelpMessageOpt("-parmsghand=<n>", strprintf(_("Set the number of threads handling messages from peers (%d to %d, 0 = auto, <0 = leave that many cores free but use at least 2, default: %d)"),
+        -GetNumCores(), MAX_MSGHAND_THREADS, DEFAULT_MSGHAND_THREADS));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
@@ -402,6 +421,7 @@ std::string HelpMessage(HelpMessageMode mode)
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     strUsage += HelpMessageOpt("-uacomment=<cmt>", _("Append comment to the user agent string"));
+    strUsage += HelpMessageOpt("-oerusignaltimeout=<n>", strprintf(_("Timeout in seconds for sending the OeruSignal beacon (default: %d)"), DEFAULT_OERUSIGNAL_TIMEOUT));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
@@ -475,10 +495,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcbatchparallel=<n>", strprintf(_("Run up to <n> read-only calls of a JSON-RPC batch at the same time, 1 to run them one by one. The extra calls take places in the -rpcworkqueue queue (default: %d)"), DEFAULT_RPC_BATCH_PARALLEL));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpceventthreads=<n>", strprintf(_("Set the number of threads accepting RPC connections and reading requests, up to %d (default: %d)"), MAX_HTTP_EVENT_THREADS, DEFAULT_HTTP_EVENT_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
-        strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
+        strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests, and for each part of a large reply to be taken by the client (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
     return strUsage;
@@ -866,8 +888,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
-    // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    // Trim requested connection counts, to fit into system limitations.
+    // select(), which is also the fallback when epoll is unavailable, cannot
+    // watch sockets numbered FD_SETSIZE or higher.
+    bool fSocketLimit = true;
+#ifdef USE_POLL
+    fSocketLimit = !InitSocketPoller()->CanWatch(FD_SETSIZE);
+#endif
+    if (fSocketLimit)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -926,6 +955,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -parheaders works the same way, for checking the scrypt PoW of headers
+    nHeaderCheckThreads = GetArg("-parheaders", DEFAULT_HEADERCHECK_THREADS);
+    if (nHeaderCheckThreads <= 0)
+        nHeaderCheckThreads += GetNumCores();
+    if (nHeaderCheckThreads <= 1)
+        nHeaderCheckThreads = 0;
+    else if (nHeaderCheckThreads > MAX_HEADERCHECK_THREADS)
+        nHeaderCheckThreads = MAX_HEADERCHECK_THREADS;
+
+    // -parprefetch too, for reading the inputs of a block before connecting it
+    nCoinsPrefetchThreads = GetArg("-parprefetch", DEFAULT_PREFETCH_THREADS);
+    if (nCoinsPrefetchThreads <= 0)
+        nCoinsPrefetchThreads += GetNumCores();
+    if (nCoinsPrefetchThreads <= 1)
+        nCoinsPrefetchThreads = 0;
+    else if (nCoinsPrefetchThreads > MAX_PREFETCH_THREADS)
+        nCoinsPrefetchThreads = MAX_PREFETCH_THREADS;
+
+    // -parmsghand as well, but message handlers spend much of their time
+    // waiting for cs_main or the disk, so by default there are at least two
+    nMessageHandlerThreads = GetArg("-parmsghand", DEFAULT_MSGHAND_THREADS);
+    if (nMessageHandlerThreads <= 0)
+        nMessageHandlerThreads = std::max(2, nMessageHandlerThreads + GetNumCores());
+    else if (nMessageHandlerThreads > MAX_MSGHAND_THREADS)
+        nMessageHandlerThreads = MAX_MSGHAND_THREADS;
+
+    mappedBlockFiles.SetMaxFiles(std::max(0, (int)GetArg("-mmapblockfiles", DEFAULT_MMAP_BLOCK_FILES)));
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1082,12 +1139,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    LogPrintf("Using %u threads for header proof-of-work verification (scrypt kernel: %s)\n", nHeaderCheckThreads, scrypt_multi_impl());
+    if (nHeaderCheckThreads) {
+        for (int i=0; i<nHeaderCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
+    }
+
+    LogPrintf("Using %u threads for prefetching block inputs\n", nCoinsPrefetchThreads);
+    if (nCoinsPrefetchThreads) {
+        for (int i=0; i<nCoinsPrefetchThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+    }
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1255,10 +1326,6 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
-    // Initialize OeruDB
-    boost::filesystem::path oeruDBPath = GetDataDir() / GetArg("-oerudb", "oeru.db");
-    COeruDB::InitOeruDB(oeruDBPath.string().c_str(), fReindex);
-
     // Initialize OeruSignal
     std::string strUAComment = GetArg("-uacomment", "");
     if (strUAComment != "")
@@ -1321,15 +1388,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsflusher;
+                delete pcoinsdbview;
                 delete pblocktree;
+                delete poeruDBMain;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+
+                // Convert a chainstate from before the per-outpoint UTXO set. This is
+                // resumable, an interrupted upgrade continues on the next start.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                pcoinsflusher = new CCoinsViewFlusher(pcoinsdbview);
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsflusher);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                // Initialize OeruDB, -oerudb is the text file used by earlier versions
+                boost::filesystem::path oeruDBPath = GetDataDir() / GetArg("-oerudb", "oeru.db");
+                COeruDB::InitOeruDB(oeruDBPath, fReindex || fReindexChainState);
+
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
@@ -1391,12 +1473,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                if (!CVerifyDB().VerifyDB(chainparams, pcoinsflusher, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
 
+                {
+                    LOCK(cs_main);
+                    COeruShield oeruShield(poeruDBMain);
+                    if (!oeruShield.SyncWithChain(chainActive)) {
+                        strLoadError = _("Unable to replay OERUShield master transactions. You need to rebuild the database using -reindex.");
+                        break;
+                    }
+                }
+
                 if (poeruDBMain->ShouldReindex(chainActive.Height())) {
                     strLoadError = _("Invalid OERUShield database detected. You need to rebuild the database using -reindex.");
                     break;
@@ -1410,7 +1501,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
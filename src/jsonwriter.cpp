@@ -0,0 +1,96 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonwriter.h"
+
+#include <assert.h>
+
+#include <univalue.h>
+
+CJSONWriter::CJSONWriter(const Sink& sinkIn, size_t nChunkSizeIn) : sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false), fGood(true)
+{
+}
+
+void CJSONWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty()) {
+        if (!vFirst.back())
+            strPending += ',';
+        vFirst.back() = false;
+    }
+}
+
+void CJSONWriter::BeginObject()
+{
+    Separate();
+    strPending += '{';
+    vFirst.push_back(true);
+}
+
+void CJSONWriter::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    strPending += '}';
+    vFirst.pop_back();
+}
+
+void CJSONWriter::BeginArray()
+{
+    Separate();
+    strPending += '[';
+    vFirst.push_back(true);
+}
+
+void CJSONWriter::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    strPending += ']';
+    vFirst.pop_back();
+}
+
+void CJSONWriter::Key(const std::string& key)
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    Separate();
+    // Let UniValue do the escaping
+    strPending += UniValue(key).write();
+    strPending += ':';
+    fAfterKey = true;
+}
+
+void CJSONWriter::Write(const UniValue& value)
+{
+    Separate();
+    strPending += value.write();
+}
+
+void CJSONWriter::Write(const std::string& key, const UniValue& value)
+{
+    Key(key);
+    Write(value);
+}
+
+void CJSONWriter::WriteRaw(const std::string& str)
+{
+    strPending += str;
+}
+
+bool CJSONWriter::MaybeFlush()
+{
+    if (IsChunkFull())
+        return Flush();
+    return fGood;
+}
+
+bool CJSONWriter::Flush()
+{
+    if (fGood && !strPending.empty())
+        fGood = sink(strPending);
+    strPending.clear();
+    return fGood;
+}
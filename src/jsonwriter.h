@@ -0,0 +1,71 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_JSONWRITER_H
+#define BITCOIN_JSONWRITER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+class UniValue;
+
+/** Size of the pieces a CJSONWriter hands to its sink */
+static const size_t DEFAULT_JSON_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON document piece by piece, so a large reply can be sent while
+ * it is being produced instead of being built as one UniValue and one string.
+ * Output is collected until the producer calls MaybeFlush() (outside of any
+ * locks) and at least nChunkSize bytes are waiting.
+ *
+ * Values are written with UniValue::write(), so the document is the same as
+ * the one the equivalent UniValue tree would give.
+ */
+class CJSONWriter
+{
+public:
+    //! Takes a piece of output; returns false to stop the writer
+    typedef boost::function<bool (const std::string& strChunk)> Sink;
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string strPending;
+    //! One entry per open object or array: whether nothing was written in it yet
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+    bool fGood;
+
+    void Separate();
+
+public:
+    explicit CJSONWriter(const Sink& sinkIn, size_t nChunkSizeIn = DEFAULT_JSON_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Start a member of the current object; write its value next
+    void Key(const std::string& key);
+    //! Write a value, as array element, member value or the whole document
+    void Write(const UniValue& value);
+    //! Write a member of the current object
+    void Write(const std::string& key, const UniValue& value);
+    //! Append text as is, e.g. the newline after the document
+    void WriteRaw(const std::string& str);
+
+    bool IsChunkFull() const { return strPending.size() >= nChunkSize; }
+    //! Hand the output to the sink if a chunk is full. False once the sink gave up.
+    bool MaybeFlush();
+    //! Hand all output to the sink. False once the sink gave up.
+    bool Flush();
+    //! False once the sink gave up; everything written afterwards is dropped
+    bool Good() const { return fGood; }
+    //! Output not handed to the sink yet
+    const std::string& GetPending() const { return strPending; }
+};
+
+#endif // BITCOIN_JSONWRITER_H
@@ -3,7 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 
+#include "kgw.h"
+
+#include <float.h>
 #include <math.h>
+#include <vector>
 
 #include "chain.h"
 #include "chainparams.h"
@@ -11,7 +15,48 @@
 #include "uint256.h"
 #include "util.h"
 
+/** PastBlocksMax used by GetNextWorkRequired, the largest mass the table needs to cover */
+static const uint64_t EVENT_HORIZON_TABLE_SIZE = 604800 / 512;
+
+double CalculateEventHorizonDeviation(uint64_t PastBlocksMass)
+{
+    return 1 + (0.7084 * pow((double(PastBlocksMass) / double(144)), -1.228));
+}
+
+static std::vector<double> CreateEventHorizonTable()
+{
+    std::vector<double> table(EVENT_HORIZON_TABLE_SIZE + 1);
+    for (uint64_t i = 1; i <= EVENT_HORIZON_TABLE_SIZE; i++)
+        table[i] = CalculateEventHorizonDeviation(i);
+    return table;
+}
+
+double GetEventHorizonDeviation(uint64_t PastBlocksMass)
+{
+    // The table is filled with the same libm pow() the loop used to call, so
+    // the values are identical to what this platform always computed. Where
+    // doubles are evaluated with excess precision (x87) a stored value could
+    // differ from one kept in a register, so those builds keep calling pow().
+#if FLT_EVAL_METHOD == 0
+    static const std::vector<double> table = CreateEventHorizonTable();
+    if (PastBlocksMass >= 1 && PastBlocksMass <= EVENT_HORIZON_TABLE_SIZE)
+        return table[PastBlocksMass];
+#endif
+    return CalculateEventHorizonDeviation(PastBlocksMass);
+}
+
 unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlockSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
+{
+    if(pindexLast == NULL)
+        return CalculateKimotoGravityWell(pindexLast, TargetBlockSpacingSeconds, PastBlocksMin, PastBlocksMax, params);
+
+    if(pindexLast->nKGWNextBits == 0)
+        pindexLast->nKGWNextBits = CalculateKimotoGravityWell(pindexLast, TargetBlockSpacingSeconds, PastBlocksMin, PastBlocksMax, params);
+
+    return pindexLast->nKGWNextBits;
+}
+
+unsigned int CalculateKimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlockSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
 {
     const CBlockIndex *BlockLastSolved = pindexLast;
     const CBlockIndex *BlockReading    = pindexLast;
@@ -52,7 +97,7 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlo
             ? double(PastRateTargetSeconds) / double(PastRateActualSeconds)
             : double(1);
 
-        EventHorizonDeviation     = 1 + (0.7084 * pow((double(PastBlocksMass) / double(144)), -1.228));
+        EventHorizonDeviation     = GetEventHorizonDeviation(PastBlocksMass);
         EventHorizonDeviationFast = EventHorizonDeviation;
         EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
 
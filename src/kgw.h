@@ -9,6 +9,22 @@
 
 class CBlockIndex;
 
+namespace Consensus { struct Params; }
+
+/**
+ * Kimoto Gravity Well difficulty for the block after pindexLast. The result
+ * is cached on pindexLast, so asking again for the same parent (competing
+ * headers, getblocktemplate, CreateNewBlock) does not walk the ancestors
+ * again. The Past* arguments must be the same on every call.
+ */
 unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlockSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params);
 
+/** EventHorizonDeviation for the given PastBlocksMass, from a table filled at first use */
+double GetEventHorizonDeviation(uint64_t PastBlocksMass);
+/** EventHorizonDeviation computed with pow(), as the table is filled */
+double CalculateEventHorizonDeviation(uint64_t PastBlocksMass);
+
+/** Reference calculation without the cache */
+unsigned int CalculateKimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlockSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params);
+
 #endif
@@ -14,8 +14,11 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
+#include "indexsnapshot.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "oerushield/oerudb.h"
@@ -70,6 +73,8 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nHeaderCheckThreads = 0;
+int nCoinsPrefetchThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
@@ -710,7 +715,9 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewFlusher *pcoinsflusher = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CMappedFileCache mappedBlockFiles(DEFAULT_MMAP_BLOCK_FILES);
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -993,15 +1000,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1140,9 +1147,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1157,7 +1164,7 @@ std::string FormatStateMessage(const CValidationState &state)
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              std::vector<COutPoint>& vCoinsToUncache)
 {
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
@@ -1256,31 +1263,25 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vCoinsToUncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -1322,8 +1323,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1565,6 +1566,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
+        entry.SetScriptFlags(scriptVerifyFlags);
 
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
@@ -1596,11 +1598,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> vCoinsToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vCoinsToUncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
     }
     return res;
 }
@@ -1609,9 +1611,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
+    CDiskBlockPos posSlow;
 
-    LOCK(cs_main);
-
+    // Only the coins lookup needs cs_main. A transaction leaves the mempool
+    // after it was written to the transaction index.
     std::shared_ptr<const CTransaction> ptx = mempool.get(hash);
     if (ptx)
     {
@@ -1641,20 +1644,23 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        LOCK(cs_main);
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
+        if (pindexSlow)
+            posSlow = pindexSlow->GetBlockPos();
     }
 
     if (pindexSlow) {
         CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
+        // A block of the active chain had its PoW checked, matching its hash is enough
+        if (ReadBlockFromDisk(block, posSlow, consensusParams, false) && block.GetHash() == pindexSlow->GetBlockHash()) {
             BOOST_FOREACH(const CTransaction &tx, block.vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
@@ -1699,12 +1705,70 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly);
+
+/**
+ * The mapping of the blk/rev file holding the record at pos, if the file is
+ * no longer appended to by FindBlockPos and the mapping covers the record and
+ * nTrailer bytes after it. nEnd is set to the end of the record.
+ */
+static std::shared_ptr<const CMappedFile> MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nTrailer, size_t& nEnd)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.IsNull() || pos.nFile >= nLastBlockFile)
+            return std::shared_ptr<const CMappedFile>();
+    }
+    // Records are preceded by the network magic and their size
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return std::shared_ptr<const CMappedFile>();
+
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    std::shared_ptr<const CMappedFile> mapping = mappedBlockFiles.Get(path, pos.nPos);
+    if (!mapping)
+        return mapping;
+    unsigned int nSize = ReadLE32((const unsigned char*)mapping->data() + pos.nPos - sizeof(nSize));
+    nEnd = (size_t)pos.nPos + nSize;
+    if (mapping->size() < nEnd + nTrailer)
+        mapping = mappedBlockFiles.Get(path, nEnd + nTrailer);
+    return mapping;
+}
+
+/** Reads a record from a blk/rev file, through its memory mapping if there is one */
+class CDiskRecordReader
+{
+private:
+    size_t nEnd;
+    std::shared_ptr<const CMappedFile> mapping;
+    CAutoFile file;
+    CSpanReader span;
+
+public:
+    CDiskRecordReader(const CDiskBlockPos& pos, const char* prefix, unsigned int nTrailer) :
+        nEnd(0),
+        mapping(MapDiskRecord(pos, prefix, nTrailer, nEnd)),
+        file(mapping ? NULL : OpenDiskFile(pos, prefix, true), SER_DISK, CLIENT_VERSION),
+        span(SER_DISK, CLIENT_VERSION, mapping ? mapping->data() + pos.nPos : NULL, mapping ? mapping->data() + nEnd + nTrailer : NULL) {}
+
+    bool IsNull() const { return !mapping && file.IsNull(); }
+
+    template<typename T>
+    CDiskRecordReader& operator>>(T& obj)
+    {
+        if (mapping)
+            span >> obj;
+        else
+            file >> obj;
+        return (*this);
+    }
+};
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     block.SetNull();
 
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CDiskRecordReader filein(pos, "blk", 0);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
@@ -1717,7 +1781,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
@@ -1725,7 +1789,11 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // A header only enters the block index after its scrypt PoW was checked, which is recorded
+    // as BLOCK_VALID_HEADER. If the block read back has the same (sha256d) hash as the index
+    // entry, it is that very header and hashing it with scrypt again would be wasted work.
+    bool fPoWVerified = (pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_HEADER;
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, !fPoWVerified))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1733,6 +1801,48 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Step back over the index header written by WriteBlockToDisk
+    unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return error("%s: no room for the index header at %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - nHeaderSize);
+
+    size_t nEnd;
+    std::shared_ptr<const CMappedFile> mapping = MapDiskRecord(pos, "blk", 0, nEnd);
+    if (mapping) {
+        const char* pheader = mapping->data() + posHeader.nPos;
+        if (memcmp(pheader, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("%s: index header mismatch at %s", __func__, pos.ToString());
+        if (nEnd - pos.nPos > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: block size %u too large at %s", __func__, nEnd - pos.nPos, pos.ToString());
+        vchBlock.assign(mapping->data() + pos.nPos, mapping->data() + nEnd);
+        return true;
+    }
+
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blkMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkMessageStart) >> nSize;
+        if (memcmp(blkMessageStart, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("%s: index header mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: block size %u too large at %s", __func__, nSize, pos.ToString());
+        vchBlock.resize(nSize);
+        filein.read((char*)begin_ptr(vchBlock), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 25 * COIN;
@@ -1935,24 +2045,15 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            Coin coin;
+            bool is_spent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(is_spent);
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.nHeight));
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1990,20 +2091,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - (int)coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - (int)coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2046,11 +2147,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2062,7 +2163,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2115,7 +2216,7 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CDiskRecordReader filein(pos, "rev", sizeof(uint256));
     if (filein.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
@@ -2164,32 +2265,29 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
  * @param undo The undo object.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @param fClean Set to false if the undo data did not apply cleanly.
+ * @return False if the output could not be restored at all.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out, bool& fClean)
 {
-    bool fClean = true;
+    bool fOverwrite = view.HaveCoin(out);
+    if (fOverwrite)
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    Coin coin(undo.txout, undo.nHeight, undo.fCoinBase);
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(coin), fOverwrite);
 
-    return fClean;
+    return true;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
@@ -2215,24 +2313,18 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
+        bool fCoinBase = tx.IsCoinBase();
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || fCoinBase != coin.IsCoinBase())
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // restore inputs
@@ -2243,8 +2335,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
+                if (!ApplyTxInUndo(undo, view, out, fClean))
+                    return false;
             }
         }
     }
@@ -2292,6 +2384,95 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Reads one coin from the base of a coins cache for PrefetchBlockInputs() */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsViewCache* pview;
+    COutPoint outpoint;
+    Coin* pcoin;
+    unsigned char* pfFound;
+
+public:
+    CCoinsPrefetch() : pview(NULL), pcoin(NULL), pfFound(NULL) {}
+    CCoinsPrefetch(const CCoinsViewCache* pviewIn, const COutPoint& outpointIn, Coin* pcoinIn, unsigned char* pfFoundIn) :
+        pview(pviewIn), outpoint(outpointIn), pcoin(pcoinIn), pfFound(pfFoundIn) {}
+
+    bool operator()() {
+        *pfFound = pview->GetCoinFromBase(outpoint, *pcoin);
+        return true;
+    }
+
+    void swap(CCoinsPrefetch& check) {
+        std::swap(pview, check.pview);
+        std::swap(outpoint, check.outpoint);
+        std::swap(pcoin, check.pcoin);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(32);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("egulden-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by a block that are not in pcoinsTip's cache yet
+ * from the coins database on the prefetch threads, and add them to that
+ * cache. ConnectBlock() then finds them there instead of waiting for every
+ * database read in turn, which dominates when the cache is cold (initial
+ * block download, -reindex-chainstate). pcoinsTip is only modified with
+ * cs_main held, so it stays unchanged while the reads are in progress.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nCoinsPrefetchThreads || pcoinsTip == NULL)
+        return;
+
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+
+    std::vector<COutPoint> vOutpoints;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                vOutpoints.push_back(txin.prevout);
+        }
+    }
+
+    // Not worth waking up the threads for a few reads
+    if (vOutpoints.size() < MIN_PREFETCH_INPUTS)
+        return;
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::vector<unsigned char> vFound(vOutpoints.size(), 0);
+    {
+        std::vector<CCoinsPrefetch> vChecks;
+        vChecks.reserve(vOutpoints.size());
+        for (unsigned int i = 0; i < vOutpoints.size(); i++)
+            vChecks.push_back(CCoinsPrefetch(pcoinsTip, vOutpoints[i], &vCoins[i], &vFound[i]));
+
+        CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vOutpoints.size(); i++) {
+        if (vFound[i]) {
+            pcoinsTip->AddFetchedCoin(vOutpoints[i], std::move(vCoins[i]));
+            nFound++;
+        }
+    }
+    LogPrint("bench", "    - Prefetched %u of %u inputs\n", nFound, (unsigned int)vOutpoints.size());
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2338,6 +2519,7 @@ public:
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
 static int64_t nTimeCheck = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
@@ -2346,7 +2528,7 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, const CTxMemPool* pool)
 {
     AssertLockHeld(cs_main);
 
@@ -2380,6 +2562,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
 
+    // Read the coins spent by this block in parallel, instead of one by one
+    // as the transactions are connected below
+    PrefetchBlockInputs(block);
+
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime1;
+    LogPrint("bench", "    - Prefetch inputs: %.2fms [%.2fs]\n", 0.001 * (nTimePrefetched - nTime1), nTimePrefetch * 0.000001);
+
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
     // If such overwrites are allowed, coinbases and transactions depending upon those
@@ -2409,10 +2598,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
@@ -2447,8 +2638,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         flags |= SCRIPT_VERIFY_NULLDUMMY;
     }
 
-    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
-    LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
+    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTimePrefetched;
+    LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTimePrefetched), nTimeForks * 0.000001);
 
     CBlockUndo blockundo;
 
@@ -2458,6 +2649,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
+    unsigned int nTxScriptsChecked = 0;
     int64_t nSigOpsCost = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
@@ -2482,7 +2674,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             // Which orphan pool entries must we evict?
@@ -2518,7 +2710,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            bool fTxScriptChecks = fScriptChecks;
+            if (fTxScriptChecks && pool && pool->ScriptsChecked(tx, flags)) {
+                fTxScriptChecks = false;
+                nTxScriptsChecked++;
+            }
+            if (!CheckInputs(tx, state, view, fTxScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2535,6 +2732,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
+    if (pool)
+        LogPrint("bench", "      - Scripts of %u transactions checked on mempool entry\n", nTxScriptsChecked);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0].GetValueOut() > blockReward)
@@ -2644,11 +2843,24 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
+    // A background coins write that failed leaves the chainstate on disk
+    // behind; stop as soon as we learn about it.
+    if (pcoinsflusher != NULL && pcoinsflusher->HasFailed())
+        return AbortNode(state, "Failed to write to coin database");
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    size_t nCacheLimit = nCoinCacheUsage;
+    if (pcoinsflusher != NULL) {
+        // The coins being written in the background take memory as well. Hand
+        // over at half the limit, so the cache can fill up again meanwhile, and
+        // wait for the write if both together would still exceed the limit.
+        nCacheLimit = nCoinCacheUsage / 2;
+        if (cacheSize + pcoinsflusher->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinsflusher->Sync())
+            return AbortNode(state, "Failed to write to coin database");
+    }
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
-    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
+    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCacheLimit;
     // The cache is over the limit, we have to write now.
-    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCacheLimit;
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
@@ -2680,23 +2892,31 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // This hands the dirty coins to the background writer, if there is
+        // one; wait for it when shutting down or before pruned files go.
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if (pcoinsflusher != NULL && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsflusher->Sync())
+            return AbortNode(state, "Failed to write to coin database");
+        // Flush the OERU certified addresses, which record the same best block.
+        if (poeruDBMain != NULL && !poeruDBMain->Flush())
+            return AbortNode(state, "Failed to write to OERU database");
+        // Finally remove any pruned files, now that the chainstate on disk
+        // no longer needs them
+        if (fFlushForPrune)
+            UnlinkPrunedFiles(setFilesToPrune);
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2793,14 +3013,6 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
         return AbortNode(state, "Failed to read block");
 
-    COeruShield oeruShield(poeruDBMain);
-    // Scan for OERU master transactions and revert them
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        oeruShield.CheckMasterTx(tx, pindexDelete->nHeight, true);
-    }
-
-
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
@@ -2809,6 +3021,16 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
+
+    COeruShield oeruShield(poeruDBMain);
+    // Scan for OERU master transactions and revert them
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        oeruShield.CheckMasterTx(tx, pindexDelete->nHeight, true);
+    }
+    if (poeruDBMain != NULL)
+        poeruDBMain->SetBestBlock(pindexDelete->pprev->GetBlockHash());
+
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
@@ -2875,12 +3097,6 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         return error("ConnectTip(): OeruShield denied block");
     }
 
-    // Scan for OERU master transactions
-    BOOST_FOREACH(const CTransaction& tx, pblock->vtx)
-    {
-        oeruShield.CheckMasterTx(tx, pindexNew->nHeight);
-    }
-
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
@@ -2899,6 +3115,15 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
+
+    // Scan for OERU master transactions
+    BOOST_FOREACH(const CTransaction& tx, pblock->vtx)
+    {
+        oeruShield.CheckMasterTx(tx, pindexNew->nHeight);
+    }
+    if (poeruDBMain != NULL)
+        poeruDBMain->SetBestBlock(pindexNew->GetBlockHash());
+
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
@@ -3436,6 +3661,98 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const
     return true;
 }
 
+/** Scratchpad for the multi-lane scrypt kernel, one per header checking thread */
+static boost::thread_specific_ptr<std::vector<char> > headerCheckScratchpad;
+
+/**
+ * Closure representing the proof-of-work check of a few headers, hashed
+ * together by the multi-lane scrypt kernel. Records the outcome for each
+ * header in the caller's result vector, as the queue only reports whether
+ * all checks passed.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *vpheader[SCRYPT_MAX_WAYS];
+    unsigned char *vpfChecked[SCRYPT_MAX_WAYS];
+    unsigned int nHeaders;
+    const Consensus::Params *pconsensusParams;
+
+public:
+    CHeaderPoWCheck(): nHeaders(0), pconsensusParams(NULL) {}
+    CHeaderPoWCheck(const Consensus::Params& consensusParams): nHeaders(0), pconsensusParams(&consensusParams) {}
+
+    bool IsFull() const { return nHeaders == std::min(scrypt_multi_ways(), (unsigned int)SCRYPT_MAX_WAYS); }
+
+    void Add(const CBlockHeader& header, unsigned char* pfChecked) {
+        assert(nHeaders < SCRYPT_MAX_WAYS);
+        vpheader[nHeaders] = &header;
+        vpfChecked[nHeaders] = pfChecked;
+        nHeaders++;
+    }
+
+    bool operator()() {
+        if (headerCheckScratchpad.get() == NULL)
+            headerCheckScratchpad.reset(new std::vector<char>(SCRYPT_MULTI_SCRATCHPAD_SIZE));
+
+        uint256 hashes[SCRYPT_MAX_WAYS];
+        CBlockHeader::GetPoWHashes(vpheader, hashes, nHeaders, &(*headerCheckScratchpad)[0]);
+
+        bool fAllOk = true;
+        for (unsigned int i = 0; i < nHeaders; i++) {
+            if (CheckProofOfWork(hashes[i], vpheader[i]->nBits, *pconsensusParams))
+                *vpfChecked[i] = 1;
+            else
+                fAllOk = false;
+        }
+        return fAllOk;
+    }
+
+    void swap(CHeaderPoWCheck& check) {
+        std::swap(vpheader, check.vpheader);
+        std::swap(vpfChecked, check.vpfChecked);
+        std::swap(nHeaders, check.nHeaders);
+        std::swap(pconsensusParams, check.pconsensusParams);
+    }
+};
+
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(16);
+/** Held by the one message handler thread that is using headercheckqueue */
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderCheck() {
+    RenameThread("egulden-headerch");
+    headercheckqueue.Thread();
+}
+
+bool CheckBlockHeadersPoW(const std::vector<CBlockHeader>& headers, std::vector<unsigned char>& vPoWChecked, const Consensus::Params& consensusParams)
+{
+    assert(vPoWChecked.size() == headers.size());
+
+    std::vector<CHeaderPoWCheck> vChecks;
+    for (unsigned int i = 0; i < headers.size(); i++) {
+        if (vPoWChecked[i])
+            continue;
+        if (vChecks.empty() || vChecks.back().IsFull())
+            vChecks.push_back(CHeaderPoWCheck(consensusParams));
+        vChecks.back().Add(headers[i], &vPoWChecked[i]);
+    }
+
+    // Not worth waking up the workers for a few announced headers. If another
+    // peer's headers are being checked by them, do this batch ourselves.
+    TRY_LOCK(cs_headercheckqueue, lockQueue);
+    if (!nHeaderCheckThreads || vChecks.size() <= 1 || !lockQueue) {
+        bool fAllOk = true;
+        BOOST_FOREACH(CHeaderPoWCheck& check, vChecks)
+            fAllOk &= check();
+        return fAllOk;
+    }
+
+    CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -3722,7 +4039,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3741,7 +4058,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3778,7 +4095,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // A block that passed CheckBlock already had its proof of work checked
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3882,10 +4200,11 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, C
     return true;
 }
 
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot, const CTxMemPool* pool)
 {
     AssertLockHeld(cs_main);
     assert(pindexPrev && pindexPrev == chainActive.Tip());
+    int64_t nTimeStart = GetTimeMicros();
     if (fCheckpointsEnabled && !CheckIndexAgainstCheckpoint(pindexPrev, state, chainparams, block.GetHash()))
         return error("%s: CheckIndexAgainstCheckpoint(): %s", __func__, state.GetRejectReason().c_str());
 
@@ -3901,9 +4220,14 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
-    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true))
+    int64_t nTime1 = GetTimeMicros();
+    LogPrint("bench", "  - Block checks: %.2fms\n", 0.001 * (nTime1 - nTimeStart));
+    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true, pool))
         return false;
     assert(state.IsValid());
+    int64_t nTime2 = GetTimeMicros();
+    LogPrint("bench", "  - Connect: %.2fms\n", 0.001 * (nTime2 - nTime1));
+    LogPrint("bench", "- Test block validity: %.2fms\n", 0.001 * (nTime2 - nTimeStart));
 
     return true;
 }
@@ -3959,6 +4283,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "blk"));
+        mappedBlockFiles.Erase(GetBlockPosFilename(pos, "rev"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4080,27 +4406,99 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
+static boost::filesystem::path GetBlockIndexSnapshotPath()
 {
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+bool DumpBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    int64_t nStart = GetTimeMillis();
+
+    // Only a fully flushed block index can be written, as the snapshot
+    // must describe exactly what the block tree database contains
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return error("%s: block index has not been flushed", __func__);
+
+    std::vector<CBlockIndex*> vIndex;
+    vIndex.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vIndex.push_back(item.second);
+
+    if (!WriteBlockIndexSnapshot(GetBlockIndexSnapshotPath(), pcoinsTip->GetBestBlock(), vIndex))
         return false;
 
-    boost::this_thread::interruption_point();
+    LogPrintf("Wrote block index snapshot with %u entries  %dms\n", vIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
 
-    // Calculate nChainWork
+/** Load the block index from the snapshot, which is removed whether it is used or not */
+static bool LoadBlockIndexFromSnapshot(std::vector<CBlockIndex*>& vSortedByHeight)
+{
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    if (!boost::filesystem::exists(pathSnapshot))
+        return false;
+
+    bool fLoaded = false;
+    if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT)) {
+        int64_t nStart = GetTimeMillis();
+        fLoaded = LoadBlockIndexSnapshot(pathSnapshot, pcoinsTip->GetBestBlock(), InsertBlockIndex, vSortedByHeight);
+        if (fLoaded) {
+            LogPrintf("Loaded block index snapshot with %u entries  %dms\n", vSortedByHeight.size(), GetTimeMillis() - nStart);
+        } else {
+            LogPrintf("Block index snapshot is not usable, loading the block index database instead\n");
+            BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex)
+                delete entry.second;
+            mapBlockIndex.clear();
+            vSortedByHeight.clear();
+        }
+    }
+
+    // The block tree database changes as soon as the node runs, so a
+    // snapshot is good for one startup only
+    try {
+        boost::filesystem::remove(pathSnapshot);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("Unable to remove block index snapshot: %s\n", e.what());
+    }
+
+    return fLoaded;
+}
+
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+
+    std::vector<CBlockIndex*> vSnapshot;
+    bool fSnapshot = LoadBlockIndexFromSnapshot(vSnapshot);
+    if (fSnapshot) {
+        // Already in height order and with nChainWork filled in
+        vSortedByHeight.reserve(vSnapshot.size());
+        BOOST_FOREACH(CBlockIndex* pindex, vSnapshot)
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    } else {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+            return false;
+
+        boost::this_thread::interruption_point();
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    // Calculate nChainWork
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (!fSnapshot)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -4391,6 +4789,7 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    mappedBlockFiles.Clear();
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
@@ -4460,6 +4859,242 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/**
+ * Reads ahead of LoadExternalBlockFile: one thread scans the file for blocks,
+ * a few more deserialize them and run the context-free checks (CheckBlock,
+ * which includes the scrypt proof of work), and the importing thread takes
+ * them back in file order. That leaves it only the work that needs cs_main.
+ */
+class CBlockFileReadAhead
+{
+public:
+    struct Entry
+    {
+        //! Position of the block in the file, after its index header
+        uint64_t nPos;
+        unsigned int nSize;
+        //! The serialized block, until it has been deserialized
+        std::vector<char> vchBlock;
+        CBlock block;
+        bool fDone;
+        //! Why the block could not be deserialized, if it could not
+        std::string strError;
+
+        Entry(uint64_t nPosIn, unsigned int nSizeIn) : nPos(nPosIn), nSize(nSizeIn), fDone(false) {}
+    };
+    typedef std::shared_ptr<Entry> EntryRef;
+
+private:
+    const CChainParams& chainparams;
+    CBufferedFile blkdat;
+
+    boost::mutex cs;
+    boost::condition_variable condReader;
+    boost::condition_variable condParser;
+    boost::condition_variable condDone;
+    //! Blocks found, in file order
+    std::deque<EntryRef> queueFound;
+    //! Blocks found that no parser has taken yet
+    std::deque<EntryRef> queueParse;
+    size_t nBytesQueued;
+    //! Bumped by Rewind(), so the reader drops a block it found before
+    unsigned int nGeneration;
+    bool fRewind;
+    uint64_t nRewindPos;
+    bool fEof;
+    bool fStop;
+    //! Set when reading the file failed in a way that should abort the node
+    std::string strFatalError;
+
+    boost::thread_group threads;
+
+    void ThreadRead();
+    void ThreadParse();
+
+public:
+    CBlockFileReadAhead(const CChainParams& chainparamsIn, FILE* fileIn, int nParsers) :
+        chainparams(chainparamsIn),
+        blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION),
+        nBytesQueued(0), nGeneration(0), fRewind(false), nRewindPos(0), fEof(false), fStop(false)
+    {
+        threads.create_thread(boost::bind(&CBlockFileReadAhead::ThreadRead, this));
+        for (int i = 0; i < nParsers; i++)
+            threads.create_thread(boost::bind(&CBlockFileReadAhead::ThreadParse, this));
+    }
+
+    ~CBlockFileReadAhead()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        condReader.notify_all();
+        condParser.notify_all();
+        threads.join_all();
+    }
+
+    /** The next block in the file. Returns false at the end of the file. */
+    bool Next(EntryRef& entry);
+
+    /** Drop whatever was read ahead, and continue scanning the file at nPos */
+    void Rewind(uint64_t nPos);
+};
+
+void CBlockFileReadAhead::ThreadRead()
+{
+    RenameThread("egulden-blkread");
+    try {
+        uint64_t nRewind = blkdat.GetPos();
+        while (true) {
+            unsigned int nGenerationFound;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && !fRewind && (fEof || (nBytesQueued >= MAX_IMPORT_READAHEAD_SIZE && !queueFound.empty())))
+                    condReader.wait(lock);
+                if (fStop)
+                    return;
+                if (fRewind) {
+                    fRewind = false;
+                    if (!blkdat.Seek(nRewindPos)) {
+                        fEof = true;
+                        condDone.notify_all();
+                        continue;
+                    }
+                    nRewind = nRewindPos;
+                }
+                nGenerationFound = nGeneration;
+            }
+
+            bool fFound = false;
+            EntryRef entry;
+            if (!blkdat.eof()) {
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                bool fHeader = true;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(chainparams.MessageStart()[0]);
+                    nRewind = blkdat.GetPos()+1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                        fHeader = false;
+                    // read size
+                    if (fHeader)
+                        blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                        fHeader = false;
+                    fFound = true;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                }
+                if (fFound && fHeader) {
+                    try {
+                        // read block
+                        uint64_t nBlockPos = blkdat.GetPos();
+                        blkdat.SetLimit(nBlockPos + nSize);
+                        entry.reset(new Entry(nBlockPos, nSize));
+                        entry->vchBlock.resize(nSize);
+                        blkdat.read(&entry->vchBlock[0], nSize);
+                        nRewind = blkdat.GetPos();
+                    } catch (const std::exception& e) {
+                        LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", e.what());
+                        entry.reset();
+                    }
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (nGenerationFound != nGeneration)
+                continue;
+            if (!fFound) {
+                fEof = true;
+                condDone.notify_all();
+            } else if (entry) {
+                nBytesQueued += entry->nSize;
+                queueFound.push_back(entry);
+                queueParse.push_back(entry);
+                condParser.notify_one();
+            }
+        }
+    } catch (const std::exception& e) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        strFatalError = e.what();
+        condDone.notify_all();
+    }
+}
+
+void CBlockFileReadAhead::ThreadParse()
+{
+    RenameThread("egulden-blkparse");
+    while (true) {
+        EntryRef entry;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fStop && queueParse.empty())
+                condParser.wait(lock);
+            if (fStop)
+                return;
+            entry = queueParse.front();
+            queueParse.pop_front();
+        }
+
+        try {
+            CSpanReader span(SER_DISK, CLIENT_VERSION, &entry->vchBlock[0], &entry->vchBlock[0] + entry->vchBlock.size());
+            span >> entry->block;
+            // Blocks that are stored already are not checked again by the importer
+            bool fHave;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(entry->block.GetHash());
+                fHave = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+            }
+            // This leaves block.fChecked set, so AcceptBlock does not repeat the work
+            CValidationState state;
+            if (!fHave)
+                CheckBlock(entry->block, state, chainparams.GetConsensus());
+        } catch (const std::exception& e) {
+            entry->strError = e.what();
+        }
+        std::vector<char>().swap(entry->vchBlock);
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        entry->fDone = true;
+        condDone.notify_all();
+    }
+}
+
+bool CBlockFileReadAhead::Next(EntryRef& entry)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (strFatalError.empty() && (queueFound.empty() ? !fEof : !queueFound.front()->fDone))
+        condDone.wait(lock);
+    if (!strFatalError.empty())
+        throw std::runtime_error(strFatalError);
+    if (queueFound.empty())
+        return false;
+    entry = queueFound.front();
+    queueFound.pop_front();
+    nBytesQueued -= entry->nSize;
+    condReader.notify_one();
+    return true;
+}
+
+void CBlockFileReadAhead::Rewind(uint64_t nPos)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    queueFound.clear();
+    queueParse.clear();
+    nBytesQueued = 0;
+    nGeneration++;
+    fRewind = true;
+    nRewindPos = nPos;
+    fEof = false;
+    condReader.notify_one();
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4468,42 +5103,24 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // This takes over fileIn and calls fclose() on it when done
+        CBlockFileReadAhead readahead(chainparams, fileIn, std::max(1, nHeaderCheckThreads));
+        CBlockFileReadAhead::EntryRef entry;
+        while (readahead.Next(entry)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (!entry->strError.empty()) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, entry->strError);
+                // The record could be garbage that happens to start with the
+                // message start, so look for a block from the byte after it
+                // instead of skipping the size it claims.
+                readahead.Rewind(entry->nPos - (MESSAGE_START_SIZE + sizeof(unsigned int)) + 1);
+                continue;
             }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                    dbp->nPos = entry->nPos;
+                CBlock& block = entry->block;
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -4831,12 +5448,14 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // Most transactions have one or two outputs, only check those.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -4852,8 +5471,6 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4866,7 +5483,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
             {
+                // Decide what to send under cs_main, but read the block from
+                // disk and send it without holding it.
                 bool send = false;
+                CBlockIndex* pindex = NULL;
+                CDiskBlockPos pos;
+                bool fPeerWantsWitness = false;
+                bool fSendCmpct = false;
+                bool fMayHaveWitness = true;
+                uint256 hashTip;
+                {
+                LOCK(cs_main);
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
@@ -4898,16 +5525,58 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    pindex = mi->second;
+                    pos = pindex->GetBlockPos();
+                    fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they wont have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    fSendCmpct = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    // Witness data is rejected (unexpected-witness) before activation
+                    fMayHaveWitness = IsWitnessEnabled(pindex->pprev, consensusParams);
+                    if (inv.hash == pfrom->hashContinue)
+                        hashTip = chainActive.Tip()->GetBlockHash();
+                }
+                }
+
+                // A full block goes out as it is stored on disk, with its
+                // witnesses, unless they have to be stripped for this peer.
+                // That saves deserializing and serializing it again.
+                bool fFullBlock = inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCmpct);
+                bool fWithWitness = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && fPeerWantsWitness);
+                bool fRaw = fFullBlock && (fWithWitness || !fMayHaveWitness);
+                std::vector<unsigned char> vchBlock;
+                CBlock block;
+                bool fRead = false;
+                if (send && fRaw) {
+                    fRead = ReadRawBlockFromDisk(vchBlock, pos, Params().MessageStart());
+                    // The hash of the header, which comes first
+                    size_t nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION);
+                    fRead = fRead && vchBlock.size() >= nHeaderSize && Hash(vchBlock.begin(), vchBlock.begin() + nHeaderSize) == inv.hash;
+                } else if (send) {
+                    // Its header was checked when it entered the block index, see
+                    // ReadBlockFromDisk(CBlock&, const CBlockIndex*, ...)
+                    fRead = ReadBlockFromDisk(block, pos, consensusParams, false) && block.GetHash() == inv.hash;
+                }
+                if (send && !fRead)
+                {
+                    // It may have been pruned since we looked it up
+                    LOCK(cs_main);
+                    if (pindex->nStatus & BLOCK_HAVE_DATA)
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    send = false;
+                }
+                if (send)
+                {
+                    // Send block from disk
+                    if (fRaw)
+                        pfrom->PushMessage(NetMsgType::BLOCK, CFlatData(vchBlock));
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, block);
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool send = false;
@@ -4936,12 +5605,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
                     else if (inv.type == MSG_CMPCT_BLOCK)
                     {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they wont have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                        if (fSendCmpct) {
                             CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
                             pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
                         } else
@@ -4949,13 +5613,13 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
+                    if (!hashTip.IsNull())
                     {
                         // Bypass PushInventory, this must send even if redundant,
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage(NetMsgType::INV, vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -4965,11 +5629,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             {
                 // Send stream from relay memory
                 bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
-                    push = true;
-                } else if (pfrom->timeLastMempoolReq) {
+                {
+                    LOCK(cs_main);
+                    auto mi = mapRelay.find(inv.hash);
+                    if (mi != mapRelay.end()) {
+                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
+                        push = true;
+                    }
+                }
+                if (!push && pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request.
@@ -6013,14 +6681,28 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
-        {
-        LOCK(cs_main);
-
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
 
+        // The cheap checks come first, so that a peer cannot make us hash
+        // headers that would be rejected anyway.
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 20);
+                return error("non-continuous headers sequence");
+            }
+        }
+
+        // Only the proof of work of new headers is verified up front, in
+        // parallel and without holding cs_main. Already known headers were
+        // checked when they were first accepted.
+        std::vector<unsigned char> vPoWChecked(nCount, 0);
+        {
+        LOCK(cs_main);
+
         CNodeState *nodestate = State(pfrom->GetId());
 
         // If this looks like it could be a block announcement (nCount <
@@ -6050,14 +6732,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        for (unsigned int n = 0; n < nCount; n++) {
+            if (mapBlockIndex.count(headers[n].GetHash()))
+                vPoWChecked[n] = 1;
+        }
+        }
+        int64_t nTimeStart = GetTimeMicros();
+        CheckBlockHeadersPoW(headers, vPoWChecked, chainparams.GetConsensus());
+        LogPrint("bench", "    - Check headers PoW: %.2fms (%u headers)\n", 0.001 * (GetTimeMicros() - nTimeStart), nCount);
+
+        {
+        LOCK(cs_main);
+
+        CNodeState *nodestate = State(pfrom->GetId());
+
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
-                Misbehaving(pfrom->GetId(), 20);
-                return error("non-continuous headers sequence");
-            }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            // Headers that failed the pre-check get checked (and rejected) again
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !vPoWChecked[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6191,7 +6885,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6585,23 +7282,15 @@ bool SendMessages(CNode* pto)
             }
         }
 
-        TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
-        if (!lockMain)
-            return true;
-
-        // Address refresh broadcast
-        int64_t nNow = GetTimeMicros();
-        if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
-            AdvertiseLocal(pto);
-            pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
-        }
-
         //
         // Message: addr
         //
+        // Needs no chainstate, so it is sent also while cs_main is busy
+        int64_t nNow = GetTimeMicros();
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
+            LOCK(pto->cs_addrSend);
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
@@ -6625,6 +7314,17 @@ bool SendMessages(CNode* pto)
                 pto->vAddrToSend.shrink_to_fit();
         }
 
+        TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
+        if (!lockMain)
+            return true;
+
+        // Address refresh broadcast
+        if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
+            AdvertiseLocal(pto);
+            pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
+        }
+
+
         CNodeState &state = *State(pto->GetId());
         if (state.fShouldBan) {
             if (pto->fWhitelisted)
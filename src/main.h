@@ -33,7 +33,9 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewFlusher;
 class CInv;
+class CMappedFileCache;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -77,11 +79,26 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** -mmapblockfiles default (number of finished blk/rev files kept memory-mapped, 0 = off).
+ *  Off on 32-bit systems, which lack the address space. */
+static const unsigned int DEFAULT_MMAP_BLOCK_FILES = sizeof(void*) >= 8 ? 64 : 0;
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of header proof-of-work checking threads allowed */
+static const int MAX_HEADERCHECK_THREADS = 16;
+/** -parheaders default (number of header proof-of-work checking threads, 0 = auto) */
+static const int DEFAULT_HEADERCHECK_THREADS = 0;
+/** Maximum number of threads prefetching block inputs allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -parprefetch default (number of threads prefetching block inputs, 0 = auto) */
+static const int DEFAULT_PREFETCH_THREADS = 0;
+/** Blocks spending fewer uncached inputs than this are not prefetched */
+static const unsigned int MIN_PREFETCH_INPUTS = 16;
+/** Maximum size of the blocks read ahead of -reindex and -loadblock imports */
+static const unsigned int MAX_IMPORT_READAHEAD_SIZE = 64 * 1024 * 1024;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -167,6 +184,8 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nHeaderCheckThreads;
+extern int nCoinsPrefetchThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -252,8 +271,14 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   pto             The node which we are sending messages to.
  */
 bool SendMessages(CNode* pto);
+/** Write the block index to a flat snapshot for a fast next startup, see indexsnapshot.h */
+bool DumpBlockIndexSnapshot();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the block input prefetching thread */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -417,8 +442,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -440,13 +465,27 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/** Read a block known to the block index. The scrypt PoW check is skipped when the index
+ *  already records a valid header and the block read back hashes to the indexed hash. */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block at pos as stored, with its witnesses, without deserializing it.
+ *  The index header in front of it must carry messageStart. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/**
+ * Check the proof of work of a batch of headers without holding cs_main,
+ * spreading the scrypt hashing over the header checking threads.
+ * Entries of vPoWChecked that are already set are skipped, the others are
+ * set for every header that passed. Headers that failed are left unset, so
+ * that AcceptBlockHeader checks them again and rejects them.
+ * Returns whether all headers passed.
+ */
+bool CheckBlockHeadersPoW(const std::vector<CBlockHeader>& headers, std::vector<unsigned char>& vPoWChecked, const Consensus::Params& consensusParams);
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks.
@@ -457,9 +496,11 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  The scripts of transactions that pool found valid on entry with the
+ *  block's verification flags are not evaluated again. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, const CTxMemPool* pool = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
@@ -467,8 +508,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
-/** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held).
+ *  Scripts already checked on entry to pool are trusted, see ConnectBlock. */
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const CTxMemPool* pool = NULL);
 
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
@@ -505,9 +547,15 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the background writer below pcoinsTip, if any (protected by cs_main) */
+extern CCoinsViewFlusher *pcoinsflusher;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Memory mappings of the blk/rev files that are no longer written to */
+extern CMappedFileCache mappedBlockFiles;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -0,0 +1,113 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pdata, nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return std::shared_ptr<const CMappedFile>();
+    struct stat st;
+    void* pdata = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        pdata = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (pdata != MAP_FAILED)
+        return std::shared_ptr<const CMappedFile>(new CMappedFile((const char*)pdata, st.st_size));
+#endif
+    return std::shared_ptr<const CMappedFile>();
+}
+
+CMappedFileCache::CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn), nHits(0), nMisses(0)
+{
+}
+
+void CMappedFileCache::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (listMapped.size() > nMaxFiles) {
+        mapMapped.erase(listMapped.back().first);
+        listMapped.pop_back();
+    }
+}
+
+std::shared_ptr<const CMappedFile> CMappedFileCache::Get(const boost::filesystem::path& path, size_t nMinSize)
+{
+    std::string strPath = path.string();
+    LOCK(cs);
+    if (nMaxFiles == 0)
+        return std::shared_ptr<const CMappedFile>();
+
+    std::map<std::string, MappedList::iterator>::iterator it = mapMapped.find(strPath);
+    if (it != mapMapped.end()) {
+        if (it->second->second->size() >= nMinSize) {
+            nHits++;
+            listMapped.splice(listMapped.begin(), listMapped, it->second);
+            return listMapped.front().second;
+        }
+        // The file has grown since it was mapped
+        listMapped.erase(it->second);
+        mapMapped.erase(it);
+    }
+
+    nMisses++;
+    std::shared_ptr<const CMappedFile> mapping = CMappedFile::Open(path);
+    if (!mapping || mapping->size() < nMinSize)
+        return std::shared_ptr<const CMappedFile>();
+    listMapped.push_front(std::make_pair(strPath, mapping));
+    mapMapped[strPath] = listMapped.begin();
+    while (listMapped.size() > nMaxFiles) {
+        mapMapped.erase(listMapped.back().first);
+        listMapped.pop_back();
+    }
+    return mapping;
+}
+
+void CMappedFileCache::Erase(const boost::filesystem::path& path)
+{
+    LOCK(cs);
+    std::map<std::string, MappedList::iterator>::iterator it = mapMapped.find(path.string());
+    if (it != mapMapped.end()) {
+        listMapped.erase(it->second);
+        mapMapped.erase(it);
+    }
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    listMapped.clear();
+    mapMapped.clear();
+}
+
+size_t CMappedFileCache::GetMappedFiles()
+{
+    LOCK(cs);
+    return listMapped.size();
+}
+
+void CMappedFileCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut)
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
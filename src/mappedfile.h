@@ -0,0 +1,81 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * A read-only memory mapping of a whole file. It is unmapped when the last
+ * reference to it goes away, so readers can keep using it after it has been
+ * dropped from a CMappedFileCache.
+ */
+class CMappedFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    ~CMappedFile();
+
+    //! Map the file at path. Returns NULL if it cannot be mapped, or mapping is not supported.
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Keeps up to nMaxFiles files mapped, dropping the least recently used one
+ * when another is needed. Files may grow (but not shrink) while they are
+ * mapped; a mapping that turns out too short is replaced. Files must be
+ * Erase()d before they are deleted.
+ */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<const CMappedFile> > > MappedList;
+
+    CCriticalSection cs;
+    size_t nMaxFiles;
+    //! Most recently used first
+    MappedList listMapped;
+    std::map<std::string, MappedList::iterator> mapMapped;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn);
+
+    //! Change the number of files kept mapped. 0 disables the cache.
+    void SetMaxFiles(size_t nMaxFilesIn);
+
+    //! The mapping of the file at path, at least nMinSize bytes long. NULL if there is none.
+    std::shared_ptr<const CMappedFile> Get(const boost::filesystem::path& path, size_t nMinSize);
+
+    //! Forget the mapping of the file at path
+    void Erase(const boost::filesystem::path& path);
+
+    void Clear();
+
+    size_t GetMappedFiles();
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut);
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
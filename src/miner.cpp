@@ -29,10 +29,13 @@
 #include "validationinterface.h"
 
 #include "base58.h"
+#ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
+#endif
 
 #include <algorithm>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
 
@@ -53,6 +56,9 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 uint64_t nLastBlockWeight = 0;
 
+/** Mempool changes noted for the template updater before it gives up on them and assembles anew */
+static const size_t MAX_TEMPLATE_PENDING_CHANGES = 10000;
+
 class ScoreCompare
 {
 public:
@@ -130,12 +136,32 @@ void BlockAssembler::resetBlock()
 
 CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
 {
+    LOCK2(cs_main, mempool.cs);
+    if (!AssembleBlock(scriptPubKeyIn))
+        return NULL;
+
+    int64_t nTimeStart = GetTimeMicros();
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false, &mempool)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+    LogPrint("bench", "CreateNewBlock() validity: %.2fms\n", 0.001 * (GetTimeMicros() - nTimeStart));
+
+    return pblocktemplate.release();
+}
+
+bool BlockAssembler::AssembleBlock(const CScript& scriptPubKeyIn)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
     resetBlock();
+    feeRateLowest = CFeeRate(MAX_MONEY);
+    fPackagesLeftOut = false;
 
     pblocktemplate.reset(new CBlockTemplate());
 
     if(!pblocktemplate.get())
-        return NULL;
+        return false;
     pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
@@ -143,8 +169,7 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    LOCK2(cs_main, mempool.cs);
-    CBlockIndex* pindexPrev = chainActive.Tip();
+    pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
@@ -168,9 +193,28 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
 
+    int64_t nTimeStart = GetTimeMicros();
     addPriorityTxs();
+    int64_t nTime1 = GetTimeMicros();
     addPackageTxs();
+    int64_t nTime2 = GetTimeMicros();
+    LogPrint("bench", "CreateNewBlock() priority: %.2fms, packages: %.2fms\n", 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime2 - nTime1));
+
+    scriptPubKey = scriptPubKeyIn;
+    fOeruBaseOut = false;
+#ifdef ENABLE_WALLET
+    fOeruBaseOut = createOeruBaseOutput(nHeight, oeruBaseOut);
+    if (!fOeruBaseOut) {
+        LogPrintf("CreateNewBlock(): Unable to sign block");
+    }
+#endif
+
+    FinishBlock();
+    return true;
+}
 
+void BlockAssembler::FinishBlock()
+{
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
@@ -180,18 +224,12 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     coinbaseTx.vin.resize(1);
     coinbaseTx.vin[0].prevout.SetNull();
     coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKey;
     coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
     coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
 
-#ifdef ENABLE_WALLET
-    CTxOut oeruBaseOut;
-    if (createOeruBaseOutput(nHeight, oeruBaseOut)) {
+    if (fOeruBaseOut)
         coinbaseTx.vout.push_back(oeruBaseOut);
-    } else {
-        LogPrintf("CreateNewBlock(): Unable to sign block");
-    }
-#endif
 
     pblock->vtx[0] = coinbaseTx;
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
@@ -206,13 +244,103 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
+}
 
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+bool BlockAssembler::UpdateBlock(const std::vector<uint256>& vAdded, const std::vector<uint256>& vRemoved, bool& fChanged)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    assert(pblocktemplate.get() && pindexPrev == chainActive.Tip());
+    fChanged = false;
+    bool fReassemble = false;
+
+    // Transactions leave the mempool together with their descendants, so taking
+    // them out keeps the order of the block valid. Should something in the block
+    // have left the mempool unnoticed, it goes too, with what spends it.
+    std::set<uint256> setGone(vRemoved.begin(), vRemoved.end());
+    bool fGone = false;
+    for (unsigned int i = 1; i < pblock->vtx.size() && !fGone; i++) {
+        const uint256& hash = pblock->vtx[i].GetHash();
+        fGone = setGone.count(hash) || mempool.mapTx.find(hash) == mempool.mapTx.end();
+    }
+    if (fGone) {
+        std::vector<CTransaction> vtx;
+        vtx.swap(pblock->vtx);
+        bool fIncludeWitnessBlock = fIncludeWitness;
+        resetBlock();
+        fIncludeWitness = fIncludeWitnessBlock;
+        pblock->vtx.push_back(vtx[0]);
+        pblocktemplate->vTxFees.resize(1);
+        pblocktemplate->vTxSigOpsCost.resize(1);
+        for (unsigned int i = 1; i < vtx.size(); i++) {
+            const uint256& hash = vtx[i].GetHash();
+            bool fSpendsGone = false;
+            BOOST_FOREACH(const CTxIn& txin, vtx[i].vin)
+                fSpendsGone |= setGone.count(txin.prevout.hash) > 0;
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (fSpendsGone || setGone.count(hash) || it == mempool.mapTx.end()) {
+                setGone.insert(hash);
+                continue;
+            }
+            AddToBlock(it);
+        }
+        fChanged = true;
+        // Room was made for what did not fit before
+        fReassemble |= fPackagesLeftOut;
     }
 
-    return pblocktemplate.release();
+    // Transactions picked for their priority cannot be added one by one
+    if (GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE) > 0) {
+        if (fChanged)
+            FinishBlock();
+        return !vAdded.empty() || fReassemble;
+    }
+
+    // Add the packages of the new transactions that fit, as addPackageTxs would
+    BOOST_FOREACH(const uint256& hash, vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end() || inBlock.count(it))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*it, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(it);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        BOOST_FOREACH(CTxMemPool::txiter ancestor, ancestors) {
+            packageSize += ancestor->GetTxSize();
+            packageFees += ancestor->GetModifiedFee();
+            packageSigOpsCost += ancestor->GetSigOpCost();
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize))
+            continue;
+
+        CFeeRate feeRatePackage(packageFees, packageSize);
+        if (!TestPackage(packageSize, packageSigOpsCost) || !TestPackageTransactions(ancestors)) {
+            // It could push out something paying less
+            fReassemble |= feeRatePackage > feeRateLowest;
+            fPackagesLeftOut = true;
+            continue;
+        }
+
+        vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, it, sortedEntries);
+        for (size_t i=0; i<sortedEntries.size(); ++i)
+            AddToBlock(sortedEntries[i]);
+        feeRateLowest = std::min(feeRateLowest, feeRatePackage);
+        fChanged = true;
+    }
+
+    if (fChanged)
+        FinishBlock();
+    return fReassemble;
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
@@ -481,6 +609,7 @@ void BlockAssembler::addPackageTxs()
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
+            fPackagesLeftOut = true;
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -501,6 +630,7 @@ void BlockAssembler::addPackageTxs()
 
         // Test if all tx's are Final
         if (!TestPackageTransactions(ancestors)) {
+            fPackagesLeftOut = true;
             if (fUsingModified) {
                 mapModifiedTx.get<ancestor_score>().erase(modit);
                 failedTx.insert(iter);
@@ -518,6 +648,8 @@ void BlockAssembler::addPackageTxs()
             mapModifiedTx.erase(sortedEntries[i]);
         }
 
+        feeRateLowest = std::min(feeRateLowest, CFeeRate(packageFees, packageSize));
+
         // Update transactions that depend on each of these
         UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
@@ -649,6 +781,112 @@ bool BlockAssembler::createOeruBaseOutput(const int nHeight, CTxOut &oeruBaseOut
 }
 #endif
 
+CBlockTemplateUpdater::CBlockTemplateUpdater(const CChainParams& _chainparams, const CScript& scriptPubKeyIn)
+    : assembler(_chainparams), chainparams(_chainparams), scriptPubKey(scriptPubKeyIn), pindexPrev(NULL),
+      nLastAssembled(0), fReassemble(false), fOverflow(false), nChanges(0), nChangesApplied(0)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateUpdater::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateUpdater::TransactionRemoved, this, _1));
+}
+
+CBlockTemplateUpdater::~CBlockTemplateUpdater()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateUpdater::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateUpdater::TransactionRemoved, this, _1));
+}
+
+void CBlockTemplateUpdater::TransactionAdded(const CTransaction& tx)
+{
+    LOCK(cs);
+    nChanges++;
+    if (fOverflow)
+        return;
+    vAdded.push_back(tx.GetHash());
+    if (vAdded.size() > MAX_TEMPLATE_PENDING_CHANGES) {
+        // Cheaper to start over than to go through all of them
+        fOverflow = true;
+        vAdded.clear();
+        vRemoved.clear();
+    }
+}
+
+void CBlockTemplateUpdater::TransactionRemoved(const CTransaction& tx)
+{
+    LOCK(cs);
+    nChanges++;
+    if (fOverflow)
+        return;
+    vRemoved.push_back(tx.GetHash());
+    if (vRemoved.size() > MAX_TEMPLATE_PENDING_CHANGES) {
+        fOverflow = true;
+        vAdded.clear();
+        vRemoved.clear();
+    }
+}
+
+CBlockTemplate* CBlockTemplateUpdater::Get()
+{
+    AssertLockHeld(cs_main);
+    LOCK(mempool.cs);
+
+    // Nothing can enter or leave the mempool while mempool.cs is held
+    std::vector<uint256> vAddedNow, vRemovedNow;
+    bool fOverflowNow;
+    {
+        LOCK(cs);
+        vAddedNow.swap(vAdded);
+        vRemovedNow.swap(vRemoved);
+        fOverflowNow = fOverflow;
+        fOverflow = false;
+        nChangesApplied = nChanges;
+    }
+
+    bool fChanged = false;
+    if (pindexPrev != chainActive.Tip() || !assembler.GetBlockTemplate() || fOverflowNow) {
+        fReassemble = true;
+        nLastAssembled = 0;
+    } else if (!vAddedNow.empty() || !vRemovedNow.empty()) {
+        int64_t nTimeStart = GetTimeMicros();
+        fReassemble |= assembler.UpdateBlock(vAddedNow, vRemovedNow, fChanged);
+        LogPrint("bench", "Updated block template with %u added and %u removed transactions: %.2fms\n",
+                 vAddedNow.size(), vRemovedNow.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+    }
+
+    if (fReassemble && GetTime() - nLastAssembled >= BLOCK_TEMPLATE_REBUILD_INTERVAL) {
+        pindexPrev = NULL;
+        if (!assembler.AssembleBlock(scriptPubKey))
+            return NULL;
+        pindexPrev = chainActive.Tip();
+        nLastAssembled = GetTime();
+        fReassemble = false;
+        fChanged = true;
+    }
+
+    if (fChanged) {
+        int64_t nTimeStart = GetTimeMicros();
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, assembler.GetBlockTemplate()->block, chainActive.Tip(), false, false, &mempool)) {
+            pindexPrev = NULL;
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+        LogPrint("bench", "Block template validity: %.2fms\n", 0.001 * (GetTimeMicros() - nTimeStart));
+    }
+
+    return assembler.GetBlockTemplate();
+}
+
+uint64_t CBlockTemplateUpdater::GetChanges()
+{
+    LOCK(cs);
+    return nChanges;
+}
+
+uint64_t CBlockTemplateUpdater::GetChangesApplied()
+{
+    LOCK(cs);
+    return nChangesApplied;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
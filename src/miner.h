@@ -6,7 +6,10 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
 #include "primitives/block.h"
+#include "script/script.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
@@ -17,12 +20,13 @@
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
-class CScript;
 class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Minimum time in seconds between rebuilding the getblocktemplate template for the same tip */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -73,7 +77,7 @@ struct modifiedentry_iter {
 // except operating on CTxMemPoolModifiedEntry.
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
     {
         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
@@ -88,7 +92,7 @@ struct CompareModifiedEntry {
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
 struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
     {
         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
@@ -153,10 +157,22 @@ private:
     CTxMemPool::setEntries inBlock;
 
     // Chain context for the block
+    CBlockIndex* pindexPrev;
     int nHeight;
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
 
+    // Coinbase outputs, kept for FinishBlock
+    CScript scriptPubKey;
+    bool fOeruBaseOut;
+    CTxOut oeruBaseOut;
+
+    // Variables used for UpdateBlock
+    /** Lowest fee rate of the packages in the block */
+    CFeeRate feeRateLowest;
+    /** Whether packages worth including did not fit in the block */
+    bool fPackagesLeftOut;
+
     // Variables used for addPriorityTxs
     int lastFewTxs;
     bool blockFinished;
@@ -166,10 +182,25 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    /** Assemble a new block template on the current tip like CreateNewBlock, but
+     *  keep it for UpdateBlock and leave checking it to the caller.
+     *  cs_main and mempool.cs must be held. */
+    bool AssembleBlock(const CScript& scriptPubKeyIn);
+    /** Bring the kept template up to date with the transactions that entered
+     *  (vAdded) and left (vRemoved) the mempool since, on the same tip.
+     *  fChanged tells whether the template changed. Returns true if assembling
+     *  the block anew would do better than the update could.
+     *  cs_main and mempool.cs must be held. */
+    bool UpdateBlock(const std::vector<uint256>& vAdded, const std::vector<uint256>& vRemoved, bool& fChanged);
+    /** The kept template, NULL if there is none */
+    CBlockTemplate* GetBlockTemplate() { return pblocktemplate.get(); }
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Create the coinbase for the transactions in the block, and fill in the header */
+    void FinishBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -207,6 +238,49 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps the block template handed out by getblocktemplate up to date. The
+ * transactions that enter and leave the mempool are noted as that happens,
+ * and applied with BlockAssembler::UpdateBlock when the template is next
+ * asked for. Asking again without changes returns the same template. It is
+ * assembled anew for a new tip, or when UpdateBlock finds that would do
+ * better, at most every BLOCK_TEMPLATE_REBUILD_INTERVAL seconds.
+ */
+class CBlockTemplateUpdater
+{
+private:
+    BlockAssembler assembler;
+    const CChainParams& chainparams;
+    const CScript scriptPubKey;
+    //! The tip the template was assembled on, NULL if it has to be assembled anew
+    const CBlockIndex* pindexPrev;
+    int64_t nLastAssembled;
+    bool fReassemble;
+
+    CCriticalSection cs;
+    std::vector<uint256> vAdded;
+    std::vector<uint256> vRemoved;
+    //! Set when too many changes were noted to keep track of them
+    bool fOverflow;
+    //! Mempool changes noted, and noted before the template was last brought up to date
+    uint64_t nChanges;
+    uint64_t nChangesApplied;
+
+    void TransactionAdded(const CTransaction& tx);
+    void TransactionRemoved(const CTransaction& tx);
+
+public:
+    CBlockTemplateUpdater(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+    ~CBlockTemplateUpdater();
+
+    /** The template, up to date with the tip and the mempool. cs_main must be held. */
+    CBlockTemplate* Get();
+
+    /** Number of mempool changes so far, and before the template returned by Get(), for long polling */
+    uint64_t GetChanges();
+    uint64_t GetChangesApplied();
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
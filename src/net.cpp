@@ -16,6 +16,7 @@
 #include "crypto/common.h"
 #include "crypto/sha256.h"
 #include "hash.h"
+#include "netpoll.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "ui_interface.h"
@@ -64,12 +65,16 @@
 namespace {
     const int MAX_OUTBOUND_CONNECTIONS = 8;
     const int MAX_FEELER_CONNECTIONS = 1;
+    // Connections accepted per listening socket before the others are serviced
+    const int MAX_ACCEPTS_PER_WAKEUP = 16;
 
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
+        // Connections may be pending (socket handler thread only)
+        bool fReady;
 
-        ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted) {}
+        ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted), fReady(false) {}
     };
 }
 
@@ -91,8 +96,10 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+static CSocketPoller* pSocketPoller = NULL;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+int nMessageHandlerThreads = 1;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -110,7 +117,12 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+
+// Message handler threads sleep on this until a message comes in. fMsgProcWake
+// remembers a wakeup that happened while they were all busy.
+static boost::mutex mutexMsgProc;
+static boost::condition_variable condMsgProc;
+static bool fMsgProcWake = false;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -436,6 +448,12 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure
 
         addrman.Attempt(addrConnect, fCountFailure);
 
+        if (!pSocketPoller->Add(hSocket)) {
+            LogPrintf("Cannot create connection: cannot watch socket with %s\n", pSocketPoller->GetName());
+            CloseSocket(hSocket);
+            return NULL;
+        }
+
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
@@ -484,6 +502,8 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        if (pSocketPoller)
+            pSocketPoller->Remove(hSocket);
         CloseSocket(hSocket);
     }
 
@@ -762,7 +782,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
 
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            WakeMessageHandler();
         }
     }
 
@@ -1015,7 +1035,8 @@ static bool AttemptToEvictConnection() {
     return false;
 }
 
-static void AcceptConnection(const ListenSocket& hListenSocket) {
+/** Accept a connection. Returns false if there was none, or on error. */
+static bool AcceptConnection(ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
     SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
@@ -1038,16 +1059,18 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     if (hSocket == INVALID_SOCKET)
     {
         int nErr = WSAGetLastError();
-        if (nErr != WSAEWOULDBLOCK)
+        if (nErr == WSAEWOULDBLOCK)
+            hListenSocket.fReady = false;
+        else
             LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-        return;
+        return false;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!pSocketPoller->CanWatch(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
-        return;
+        return true;
     }
 
     // According to the internet TCP_NODELAY is not carried into accepted sockets
@@ -1063,7 +1086,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
         CloseSocket(hSocket);
-        return;
+        return true;
     }
 
     if (nInbound >= nMaxInbound)
@@ -1072,10 +1095,17 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
             // No connection to evict, disconnect the new connection
             LogPrint("net", "failed to find an eviction candidate - connection dropped (full)\n");
             CloseSocket(hSocket);
-            return;
+            return true;
         }
     }
 
+    if (!pSocketPoller->Add(hSocket))
+    {
+        LogPrintf("connection from %s dropped: cannot watch socket with %s\n", addr.ToString(), pSocketPoller->GetName());
+        CloseSocket(hSocket);
+        return true;
+    }
+
     CNode* pnode = new CNode(hSocket, addr, "", true);
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
@@ -1086,11 +1116,14 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    return true;
 }
 
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    // Some socket was left ready with work to do, so do not wait
+    bool fMore = false;
     while (true)
     {
         //
@@ -1157,96 +1190,43 @@ void ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for sockets to become ready
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
+        // Readiness is edge-triggered (see CSocketPoller): it is remembered in
+        // nSocketReady until a read or write finds the socket exhausted. Only
+        // then is the direction rearmed. A node that is ready but has nothing
+        // to do keeps its readiness without waking this thread up.
+        //
+        std::vector<std::pair<SOCKET, int> > vEvents;
+        if (!pSocketPoller->Wait(fMore ? 0 : 50, vEvents)) // 50ms: frequency to poll pnode->vSend
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+            int nErr = WSAGetLastError();
+            LogPrintf("socket %s error %s\n", pSocketPoller->GetName(), NetworkErrorString(nErr));
+            MilliSleep(50);
         }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
         boost::this_thread::interruption_point();
+        fMore = false;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
+        std::map<SOCKET, int> mapEvents(vEvents.begin(), vEvents.end());
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            if (hListenSocket.socket == INVALID_SOCKET)
+                continue;
+            std::map<SOCKET, int>::const_iterator it = mapEvents.find(hListenSocket.socket);
+            if (it != mapEvents.end() && (it->second & SOCKET_RECV))
+                hListenSocket.fReady = true;
+
+            int nAccepted = 0;
+            while (hListenSocket.fReady && nAccepted < MAX_ACCEPTS_PER_WAKEUP && AcceptConnection(hListenSocket))
+                nAccepted++;
+            if (!hListenSocket.fReady)
+                pSocketPoller->Rearm(hListenSocket.socket, SOCKET_RECV);
+            else if (nAccepted == MAX_ACCEPTS_PER_WAKEUP)
+                fMore = true;
         }
 
         //
@@ -1263,15 +1243,39 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (!mapEvents.empty()) {
+                std::map<SOCKET, int>::const_iterator it = mapEvents.find(pnode->hSocket);
+                if (it != mapEvents.end())
+                    pnode->nSocketReady |= it->second & (SOCKET_RECV | SOCKET_SEND);
+            }
+
             //
             // Receive
             //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            // If there is data to send, first drain the write buffer before receiving
+            // more. This avoids needlessly queueing received data, if the remote peer
+            // is not themselves receiving data. This means properly utilizing TCP flow
+            // control signalling. Otherwise, receive if there is no (complete) message
+            // in the receive buffer, or there is space left in it.
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            //
+            bool fSending = false;
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                fSending = lockSend && !pnode->vSendMsg.empty();
+            }
+            if ((pnode->nSocketReady & SOCKET_RECV) && !fSending)
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
+                if (lockRecv && (
+                    pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                    pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
                 {
                     {
                         // typical socket buffer is 8K-64K
@@ -1284,6 +1288,13 @@ void ThreadSocketHandler()
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
                             pnode->RecordBytesRecv(nBytes);
+                            // A short read drained the socket
+                            if (nBytes < (int)sizeof(pchBuf)) {
+                                pnode->nSocketReady &= ~SOCKET_RECV;
+                                pSocketPoller->Rearm(pnode->hSocket, SOCKET_RECV);
+                            } else {
+                                fMore = true;
+                            }
                         }
                         else if (nBytes == 0)
                         {
@@ -1296,7 +1307,12 @@ void ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                            if (nErr == WSAEWOULDBLOCK)
+                            {
+                                pnode->nSocketReady &= ~SOCKET_RECV;
+                                pSocketPoller->Rearm(pnode->hSocket, SOCKET_RECV);
+                            }
+                            else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
@@ -1312,11 +1328,17 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if ((pnode->nSocketReady & SOCKET_SEND) && fSending)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend && !pnode->vSendMsg.empty()) {
                     SocketSendData(pnode);
+                    // Whatever is left could not be sent without blocking
+                    if (!pnode->vSendMsg.empty() && pnode->hSocket != INVALID_SOCKET) {
+                        pnode->nSocketReady &= ~SOCKET_SEND;
+                        pSocketPoller->Rearm(pnode->hSocket, SOCKET_SEND);
+                    }
+                }
             }
 
             //
@@ -1839,11 +1861,21 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
-void ThreadMessageHandler()
+void WakeMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    {
+        boost::lock_guard<boost::mutex> lock(mutexMsgProc);
+        fMsgProcWake = true;
+    }
+    condMsgProc.notify_one();
+}
 
+void ThreadMessageHandler()
+{
+    // There are nMessageHandlerThreads of these, all walking the same list of
+    // nodes. A node is handled by one thread at a time (cs_msgProcessing), so
+    // its messages are still processed in order, but a node whose message is
+    // waiting for cs_main or the disk no longer holds up the others.
     while (true)
     {
         std::vector<CNode*> vNodesCopy;
@@ -1862,6 +1894,11 @@ void ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Another thread is busy with this node
+            TRY_LOCK(pnode->cs_msgProcessing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1896,8 +1933,10 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        boost::unique_lock<boost::mutex> lock(mutexMsgProc);
+        if (fSleep && !fMsgProcWake)
+            condMsgProc.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        fMsgProcWake = false;
     }
 }
 
@@ -2055,6 +2094,15 @@ void static Discover(boost::thread_group& threadGroup)
 #endif
 }
 
+const CSocketPoller* InitSocketPoller()
+{
+    if (pSocketPoller == NULL) {
+        pSocketPoller = CreateSocketPoller();
+        LogPrintf("Using %s to wait for network sockets\n", pSocketPoller->GetName());
+    }
+    return pSocketPoller;
+}
+
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
     uiInterface.InitMessage(_("Loading addresses..."));
@@ -2102,6 +2150,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+    InitSocketPoller();
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        if (hListenSocket.socket != INVALID_SOCKET && !pSocketPoller->Add(hListenSocket.socket))
+            LogPrintf("Cannot watch listening socket with %s\n", pSocketPoller->GetName());
+
     Discover(threadGroup);
 
     //
@@ -2126,7 +2179,9 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    LogPrintf("Using %u message handler threads\n", nMessageHandlerThreads);
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2173,6 +2228,8 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+        delete pSocketPoller;
+        pSocketPoller = NULL;
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2461,6 +2518,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nServices = NODE_NONE;
     nServicesExpected = NODE_NONE;
     hSocket = hSocketIn;
+    nSocketReady = 0;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
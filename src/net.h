@@ -32,6 +32,7 @@
 class CAddrMan;
 class CScheduler;
 class CNode;
+class CSocketPoller;
 
 namespace boost {
     class thread_group;
@@ -73,6 +74,10 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
+/** -parmsghand default (number of message handler threads, 0 = auto) */
+static const int DEFAULT_MSGHAND_THREADS = 0;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -95,9 +100,13 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
+/** Create the socket poller ahead of StartNode, so the connection limits can be fitted to it */
+const CSocketPoller* InitSocketPoller();
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+void ThreadMessageHandler();
+void WakeMessageHandler();
 
 struct CombinerAll
 {
@@ -165,6 +174,8 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Number of threads running ThreadMessageHandler() */
+extern int nMessageHandlerThreads;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -325,6 +336,8 @@ public:
     ServiceFlags nServices;
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
+    // SOCKET_* directions hSocket is known to be ready in (socket handler thread only)
+    int nSocketReady;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
@@ -335,6 +348,9 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Held by the message handler thread working on this node, so its
+    // messages are processed (and its sends prepared) one at a time, in order
+    CCriticalSection cs_msgProcessing;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -396,8 +412,11 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // Other nodes' message handlers relay addresses to this node, so these
+    // two are protected by cs_addrSend
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_addrSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -514,6 +533,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -522,6 +542,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -0,0 +1,165 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoll.h"
+
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#ifdef USE_POLL
+#include <sys/epoll.h>
+#endif
+
+bool CSelectSocketPoller::CanWatch(SOCKET hSocket) const
+{
+#ifdef WIN32
+    return true;
+#else
+    return hSocket < FD_SETSIZE;
+#endif
+}
+
+bool CSelectSocketPoller::Add(SOCKET hSocket)
+{
+    if (!CanWatch(hSocket))
+        return false;
+    LOCK(cs);
+    mapWatched[hSocket] = SOCKET_RECV | SOCKET_SEND;
+    return true;
+}
+
+void CSelectSocketPoller::Remove(SOCKET hSocket)
+{
+    LOCK(cs);
+    mapWatched.erase(hSocket);
+}
+
+void CSelectSocketPoller::Rearm(SOCKET hSocket, int nEvents)
+{
+    LOCK(cs);
+    std::map<SOCKET, int>::iterator it = mapWatched.find(hSocket);
+    if (it != mapWatched.end())
+        it->second |= nEvents & (SOCKET_RECV | SOCKET_SEND);
+}
+
+bool CSelectSocketPoller::Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, int> >& vEvents)
+{
+    vEvents.clear();
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+    {
+        LOCK(cs);
+        for (std::map<SOCKET, int>::const_iterator it = mapWatched.begin(); it != mapWatched.end(); it++) {
+            if (it->second & SOCKET_RECV) {
+                FD_SET(it->first, &fdsetRecv);
+                FD_SET(it->first, &fdsetError);
+            }
+            if (it->second & SOCKET_SEND)
+                FD_SET(it->first, &fdsetSend);
+            if (it->second) {
+                hSocketMax = std::max(hSocketMax, it->first);
+                have_fds = true;
+            }
+        }
+    }
+
+    if (!have_fds) {
+        // Windows does not allow select() on empty sets
+        MilliSleep(nTimeout);
+        return true;
+    }
+
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR)
+        return WSAGetLastError() == WSAEINTR;
+
+    LOCK(cs);
+    for (std::map<SOCKET, int>::iterator it = mapWatched.begin(); nSelect > 0 && it != mapWatched.end(); it++) {
+        int nEvents = 0;
+        if ((it->second & SOCKET_RECV) && FD_ISSET(it->first, &fdsetRecv))
+            nEvents |= SOCKET_RECV;
+        if ((it->second & SOCKET_RECV) && FD_ISSET(it->first, &fdsetError))
+            nEvents |= SOCKET_RECV | SOCKET_ERR;
+        if ((it->second & SOCKET_SEND) && FD_ISSET(it->first, &fdsetSend))
+            nEvents |= SOCKET_SEND;
+        if (nEvents) {
+            it->second &= ~nEvents;
+            vEvents.push_back(std::make_pair(it->first, nEvents));
+        }
+    }
+    return true;
+}
+
+#ifdef USE_POLL
+/** Maximum number of events taken from the kernel per Wait() */
+static const int MAX_EPOLL_EVENTS = 256;
+
+CEpollSocketPoller::CEpollSocketPoller()
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+CEpollSocketPoller::~CEpollSocketPoller()
+{
+    if (epollfd != -1)
+        close(epollfd);
+}
+
+bool CEpollSocketPoller::Add(SOCKET hSocket)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = hSocket;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &event) == 0;
+}
+
+void CEpollSocketPoller::Remove(SOCKET hSocket)
+{
+    struct epoll_event event;
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, hSocket, &event);
+}
+
+bool CEpollSocketPoller::Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, int> >& vEvents)
+{
+    vEvents.clear();
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, nTimeout);
+    if (nEvents < 0)
+        return errno == EINTR;
+
+    for (int i = 0; i < nEvents; i++) {
+        int nFlags = 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            nFlags |= SOCKET_RECV;
+        if (events[i].events & (EPOLLHUP | EPOLLERR))
+            nFlags |= SOCKET_ERR;
+        if (events[i].events & EPOLLOUT)
+            nFlags |= SOCKET_SEND;
+        vEvents.push_back(std::make_pair((SOCKET)events[i].data.fd, nFlags));
+    }
+    return true;
+}
+#endif
+
+CSocketPoller* CreateSocketPoller()
+{
+#ifdef USE_POLL
+    CEpollSocketPoller* pepoll = new CEpollSocketPoller();
+    if (pepoll->IsValid())
+        return pepoll;
+    LogPrintf("epoll_create1 failed: %s, falling back to select()\n", NetworkErrorString(errno));
+    delete pepoll;
+#endif
+    return new CSelectSocketPoller();
+}
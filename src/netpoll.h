@@ -0,0 +1,111 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLL_H
+#define BITCOIN_NETPOLL_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** Readiness of a socket, as reported by CSocketPoller::Wait() */
+enum SocketEvents
+{
+    SOCKET_RECV = (1 << 0),
+    SOCKET_SEND = (1 << 1),
+    SOCKET_ERR = (1 << 2),
+};
+
+/**
+ * Waits for readiness of a set of sockets.
+ *
+ * Sockets are registered once, when they are opened, and removed before
+ * they are closed. Readiness is edge-triggered: after a socket has been
+ * reported readable (or writable) it is not reported again until the caller
+ * has read (or written) until the operation would block, or got less than
+ * it asked for, and then called Rearm() for that direction. This keeps the
+ * cost of a wakeup proportional to the number of sockets that changed, and
+ * lets the caller leave a ready socket alone (e.g. for flow control)
+ * without being woken up for it again.
+ */
+class CSocketPoller
+{
+public:
+    virtual ~CSocketPoller() {}
+
+    virtual const char* GetName() const = 0;
+
+    //! Whether hSocket can be registered at all
+    virtual bool CanWatch(SOCKET hSocket) const = 0;
+
+    //! Start watching hSocket in both directions
+    virtual bool Add(SOCKET hSocket) = 0;
+
+    //! Stop watching hSocket. Must be called before it is closed.
+    virtual void Remove(SOCKET hSocket) = 0;
+
+    //! Report readiness again for the SOCKET_* directions in nEvents, which the caller found exhausted
+    virtual void Rearm(SOCKET hSocket, int nEvents) = 0;
+
+    //! Wait up to nTimeout milliseconds for sockets to become ready. Returns false on error.
+    virtual bool Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, int> >& vEvents) = 0;
+};
+
+/**
+ * Poller based on select(). It rebuilds its fd_sets on every Wait() and
+ * cannot watch sockets numbered FD_SETSIZE or higher (outside Windows).
+ * Edge-triggering is emulated by leaving reported directions out of the
+ * sets until they are rearmed.
+ */
+class CSelectSocketPoller : public CSocketPoller
+{
+private:
+    CCriticalSection cs;
+    //! Directions each socket is watched in
+    std::map<SOCKET, int> mapWatched;
+
+public:
+    const char* GetName() const { return "select"; }
+    bool CanWatch(SOCKET hSocket) const;
+    bool Add(SOCKET hSocket);
+    void Remove(SOCKET hSocket);
+    void Rearm(SOCKET hSocket, int nEvents);
+    bool Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, int> >& vEvents);
+};
+
+#ifdef USE_POLL
+/** Poller based on edge-triggered epoll, without a limit on the socket number */
+class CEpollSocketPoller : public CSocketPoller
+{
+private:
+    int epollfd;
+
+public:
+    CEpollSocketPoller();
+    ~CEpollSocketPoller();
+
+    //! Whether the epoll instance could be created
+    bool IsValid() const { return epollfd != -1; }
+
+    const char* GetName() const { return "epoll"; }
+    bool CanWatch(SOCKET hSocket) const { return true; }
+    bool Add(SOCKET hSocket);
+    void Remove(SOCKET hSocket);
+    void Rearm(SOCKET hSocket, int nEvents) {}
+    bool Wait(int64_t nTimeout, std::vector<std::pair<SOCKET, int> >& vEvents);
+};
+#endif
+
+/** Create the best poller for this system: epoll where available, select() otherwise */
+CSocketPoller* CreateSocketPoller();
+
+#endif // BITCOIN_NETPOLL_H
@@ -6,29 +6,41 @@
 
 #include "base58.h"
 #include "crypto/sha256.h"
+#include "util.h"
 
 #include <iostream>
 #include <fstream>
 #include <string>
 
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_OERU_ADDRESS = 'a';
+static const char DB_BEST_BLOCK = 'B';
+
 COeruDB* poeruDBMain = NULL;
 
-void COeruDB::InitOeruDB(std::string oeruPath, bool reindex)
+void COeruDB::InitOeruDB(const boost::filesystem::path& legacyFilePath, bool reindex)
 {
-    COeruDB* oeruDBInstance = new COeruDB(oeruPath);
-    assert(oeruDBInstance->ReadFile());
-
-    poeruDBMain = oeruDBInstance;
+    COeruDB* oeruDBInstance = new COeruDB(GetDataDir() / "oeru", 1 << 20, false, reindex);
 
-    if (reindex) {
-        poeruDBMain->ClearCertifiedAddresses();
-        poeruDBMain->WriteFile();
+    // Upgrade from the text file used by earlier versions. It was rewritten
+    // on every change, so it is assumed to match the chainstate tip.
+    if (!reindex && oeruDBInstance->GetBestBlock().IsNull() &&
+        oeruDBInstance->NumCertifiedAddresses() == 0 &&
+        boost::filesystem::exists(legacyFilePath))
+    {
+        LogPrintf("Importing OERU certified addresses from %s\n", legacyFilePath.string());
+        assert(oeruDBInstance->ImportFile(legacyFilePath.string()));
     }
+
+    poeruDBMain = oeruDBInstance;
 }
 
-COeruDB::COeruDB(std::string oeruDBFileName)
+COeruDB::COeruDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(path, nCacheSize, fMemory, fWipe), fBestBlockDirty(false)
 {
-    strOeruDBFileName = oeruDBFileName;
+    assert(Load());
 }
 
 bool COeruDB::ShouldReindex(int ChainHeight)
@@ -43,10 +55,16 @@ bool COeruDB::ShouldReindex(int ChainHeight)
 void COeruDB::AddCertifiedAddress(CBitcoinAddress addr)
 {
     vOeruCertifiedAddresses.insert(addr);
+    mapDirty[addr] = true;
 }
 
 void COeruDB::ClearCertifiedAddresses()
 {
+    for (auto it = vOeruCertifiedAddresses.begin(); it != vOeruCertifiedAddresses.end(); ++it)
+    {
+        mapDirty[*it] = false;
+    }
+
     vOeruCertifiedAddresses.clear();
 }
 
@@ -62,15 +80,7 @@ void COeruDB::GetCertifiedAddresses(std::vector<CBitcoinAddress> &vAddresses) co
 
 bool COeruDB::IsAddressCertified(CBitcoinAddress addr) const
 {
-    for (auto it = vOeruCertifiedAddresses.begin(); it != vOeruCertifiedAddresses.end(); ++it)
-    {
-        if (*it == addr)
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return vOeruCertifiedAddresses.count(addr) == 1;
 }
 
 int COeruDB::NumCertifiedAddresses() const
@@ -80,46 +90,88 @@ int COeruDB::NumCertifiedAddresses() const
 
 void COeruDB::RemoveCertifiedAddress(CBitcoinAddress addr)
 {
-    for (auto it = vOeruCertifiedAddresses.begin(); it != vOeruCertifiedAddresses.end(); )
+    if (vOeruCertifiedAddresses.erase(addr) > 0)
     {
-        if (*it == addr)
-        {
-            it = vOeruCertifiedAddresses.erase(it);
-        }
+        mapDirty[addr] = false;
+    }
+}
+
+uint256 COeruDB::GetBestBlock() const
+{
+    return hashBestBlock;
+}
+
+void COeruDB::SetBestBlock(const uint256& hashBlock)
+{
+    hashBestBlock = hashBlock;
+    fBestBlockDirty = true;
+}
+
+bool COeruDB::Flush()
+{
+    if (mapDirty.empty() && !fBestBlockDirty)
+        return true;
+
+    CDBBatch batch(db);
+    for (auto it = mapDirty.begin(); it != mapDirty.end(); ++it)
+    {
+        std::pair<char, std::string> key = std::make_pair(DB_OERU_ADDRESS, it->first.ToString());
+        if (it->second)
+            batch.Write(key, '1');
         else
-        {
-            ++it;
-        }
+            batch.Erase(key);
     }
+    batch.Write(DB_BEST_BLOCK, hashBestBlock);
+
+    LogPrint("OeruShield", "%s: writing %u changes at block %s\n", __FUNCTION__, mapDirty.size(), hashBestBlock.ToString());
+    if (!db.WriteBatch(batch, true))
+        return false;
+
+    mapDirty.clear();
+    fBestBlockDirty = false;
+
+    return true;
 }
 
-bool COeruDB::ReadFile()
+bool COeruDB::Load()
 {
-    std::ifstream dbfile(strOeruDBFileName);
+    if (!db.Read(DB_BEST_BLOCK, hashBestBlock))
+        hashBestBlock.SetNull();
 
-    std::string strAddress;
-    while (dbfile >> strAddress)
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_OERU_ADDRESS, std::string()));
+
+    while (pcursor->Valid())
     {
-        CBitcoinAddress addr(strAddress);
+        std::pair<char, std::string> key;
+        if (!pcursor->GetKey(key) || key.first != DB_OERU_ADDRESS)
+            break;
 
+        CBitcoinAddress addr(key.second);
         if (addr.IsValid())
         {
-            AddCertifiedAddress(addr);
+            vOeruCertifiedAddresses.insert(addr);
         }
-    }
 
-    dbfile.close();
+        pcursor->Next();
+    }
 
     return true;
 }
 
-bool COeruDB::WriteFile()
+bool COeruDB::ImportFile(const std::string& strFileName)
 {
-    std::ofstream dbfile(strOeruDBFileName, std::ios::out | std::ios::trunc);
+    std::ifstream dbfile(strFileName);
 
-    for (auto it = vOeruCertifiedAddresses.begin(); it != vOeruCertifiedAddresses.end(); ++it)
+    std::string strAddress;
+    while (dbfile >> strAddress)
     {
-        dbfile << it->ToString() << std::endl;
+        CBitcoinAddress addr(strAddress);
+
+        if (addr.IsValid())
+        {
+            AddCertifiedAddress(addr);
+        }
     }
 
     dbfile.close();
@@ -5,18 +5,34 @@
 #ifndef BITCOIN_OERUSHIELD_OERUDB_H
 #define BITCOIN_OERUSHIELD_OERUDB_H
 
+#include "dbwrapper.h"
+#include "uint256.h"
+
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
 
+#include <boost/filesystem/path.hpp>
+
 class CBitcoinAddress;
 
+/**
+ * Set of OERU certified addresses, stored in a LevelDB database (oeru/).
+ *
+ * Changes made by master transactions are kept in memory until Flush(),
+ * which writes them in a single atomic batch together with the hash of the
+ * block the set corresponds to. Flush() is called from FlushStateToDisk()
+ * right after the chainstate, so after an unclean shutdown the set is at
+ * most a few blocks away from the chainstate and can be caught up by
+ * COeruShield::SyncWithChain() instead of a full -reindex.
+ */
 class COeruDB
 {
 public:
-    static void InitOeruDB(std::string oeruDBPath, bool reindex);
+    static void InitOeruDB(const boost::filesystem::path& legacyFilePath, bool reindex);
 
-    COeruDB(std::string oeruDBFileName);
+    COeruDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool ShouldReindex(int ChainHeight);
     void AddCertifiedAddress(CBitcoinAddress addr);
@@ -26,18 +42,31 @@ public:
     int NumCertifiedAddresses() const;
     void RemoveCertifiedAddress(CBitcoinAddress addr);
 
-    // Reads the data from the file
-    bool ReadFile();
+    // Hash of the last block whose master transactions are reflected in the set,
+    // null if unknown (new database or imported from the legacy file)
+    uint256 GetBestBlock() const;
+    void SetBestBlock(const uint256& hashBlock);
+
+    // Writes all pending changes and the best block in one batch
+    bool Flush();
 
-    // Writes the data to the file
-    bool WriteFile();
+    // Imports the addresses from the legacy text file format
+    bool ImportFile(const std::string& strFileName);
 
 private:
+    // Reads the data from the database
+    bool Load();
+
+    CDBWrapper db;
+
     // Use a set to guarantee unique entries
     std::set<CBitcoinAddress> vOeruCertifiedAddresses;
 
-    // Database path
-    std::string strOeruDBFileName;
+    // Changes since the last flush: true if added, false if removed
+    std::map<CBitcoinAddress, bool> mapDirty;
+
+    uint256 hashBestBlock;
+    bool fBestBlockDirty;
 };
 
 extern COeruDB* poeruDBMain;
@@ -16,6 +16,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
 #include <set>
 #include <string>
 #include <vector>
@@ -37,8 +38,8 @@ bool COeruShield::AcceptBlock(const CBlock *pblock, const CBlockIndex *pindex) c
     LogPrint("OeruShield", "OERU @ Block %d:\n\t- Active: %d\n\t- Identified: %d\n\t- Certified: %d\n\t- Last certified: %d\n",
             pindex->nHeight,
             IsActive(),
-            IsBlockIdentified(pblock, pindex->nHeight),
-            IsBlockCertified(pblock, pindex->nHeight),
+            pindex->nOeruIdentified == 1,
+            blocksSinceLastCertified == 0,
             blocksSinceLastCertified);
 
     return (blocksSinceLastCertified >= 0 &&
@@ -108,8 +109,6 @@ bool COeruShield::CheckMasterTx(const CTransaction tx, const int nHeight, const
     else
         oeruDB->RemoveCertifiedAddress(miner);
 
-    oeruDB->WriteFile();
-
     return true;
 }
 
@@ -136,17 +135,30 @@ int COeruShield::GetBlocksSinceLastCertified(const CBlock *pblock, const CBlockI
     if (pindex == NULL || pindex->pprev == NULL)
         return i;
 
-    if (IsBlockCertified(pblock, pindex->nHeight))
+    if (IsBlockCertified(pblock, pindex))
         return i;
 
     // Don't read further back than we need to
     if (i > Params().OeruShieldMaxBlocksSinceLastCertified())
         return -1;
 
-    CBlock prevblock;
-    ReadBlockFromDisk(prevblock, pindex->pprev, Params().GetConsensus());
+    // Ancestors were identified when they were connected, so this
+    // normally doesn't need to read anything from disk
+    return GetBlocksSinceLastCertified(NULL, pindex->pprev, i + 1);
+}
+
+bool COeruShield::ReplayBlock(const CBlockIndex *pindex, const bool revert) const
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return false;
 
-    return GetBlocksSinceLastCertified(&prevblock, pindex->pprev, i + 1);
+    for (auto &tx : block.vtx)
+    {
+        CheckMasterTx(tx, pindex->nHeight, revert);
+    }
+
+    return true;
 }
 
 bool COeruShield::GetCoinbaseAddress(const CTransaction& coinbaseTx, CBitcoinAddress& coinbaseAddress) const
@@ -170,6 +182,33 @@ bool COeruShield::GetCoinbaseTx(const CBlock *pblock, CTransaction& coinbaseTx)
     return true;
 }
 
+bool COeruShield::GetIdentityKey(const CBlock *pblock, const CBlockIndex *pindex, CKeyID& keyID) const
+{
+    if (pindex->nOeruIdentified < 0)
+    {
+        CBlock block;
+        if (pblock == NULL) {
+            if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+                return false;
+            pblock = &block;
+        }
+
+        CTransaction coinbaseTx;
+        CBitcoinAddress coinbaseAddress;
+        CKeyID coinbaseKeyID;
+        bool fIdentified = IsBlockIdentified(pblock, pindex->nHeight) &&
+                           GetCoinbaseTx(pblock, coinbaseTx) && coinbaseTx.vout.size() >= 2 &&
+                           GetCoinbaseAddress(coinbaseTx, coinbaseAddress) &&
+                           coinbaseAddress.GetKeyID(coinbaseKeyID);
+
+        pindex->oeruIdentityKey = fIdentified ? coinbaseKeyID : uint160();
+        pindex->nOeruIdentified = fIdentified ? 1 : 0;
+    }
+
+    keyID = CKeyID(pindex->oeruIdentityKey);
+    return pindex->nOeruIdentified == 1;
+}
+
 bool COeruShield::GetDestinationAddress(const CTxOut txOut, CBitcoinAddress &destination) const
 {
     CTxDestination txDestination;
@@ -248,6 +287,69 @@ bool COeruShield::IsBlockCertified(const CBlock *pblock, const int nHeight) cons
     return oeruDB->IsAddressCertified(coinbaseAddress);
 }
 
+bool COeruShield::IsBlockCertified(const CBlock *pblock, const CBlockIndex *pindex) const
+{
+    CKeyID keyID;
+    if ( ! GetIdentityKey(pblock, pindex, keyID))
+        return false;
+
+    return oeruDB->IsAddressCertified(CBitcoinAddress(keyID));
+}
+
+bool COeruShield::SyncWithChain(const CChain& chain) const
+{
+    const CBlockIndex *pindexTip = chain.Tip();
+    if (pindexTip == NULL || oeruDB->GetBestBlock() == pindexTip->GetBlockHash())
+        return true;
+
+    // Last block whose master transactions are reflected in the database
+    const CBlockIndex *pindexLast = NULL;
+
+    if (oeruDB->GetBestBlock().IsNull() && oeruDB->NumCertifiedAddresses() > 0)
+    {
+        // Imported from the legacy file, which was kept in sync with the tip
+        pindexLast = pindexTip;
+    }
+    else if (!oeruDB->GetBestBlock().IsNull())
+    {
+        BlockMap::iterator mi = mapBlockIndex.find(oeruDB->GetBestBlock());
+        if (mi != mapBlockIndex.end())
+            pindexLast = mi->second;
+
+        // Revert blocks that were disconnected from the chain after the last flush
+        while (pindexLast != NULL && !chain.Contains(pindexLast))
+        {
+            LogPrintf("%s: reverting OERU master transactions of block %d\n", __FUNCTION__, pindexLast->nHeight);
+            if (!ReplayBlock(pindexLast, true))
+                pindexLast = NULL;
+            else
+                pindexLast = pindexLast->pprev;
+        }
+    }
+
+    if (pindexLast == NULL)
+    {
+        // Start over from the first block that can contain a master transaction
+        LogPrintf("%s: rebuilding OERU certified addresses\n", __FUNCTION__);
+        oeruDB->ClearCertifiedAddresses();
+        int nHeight = std::max(Params().OeruShieldFirstMasterTXHeight() - 1, 0);
+        pindexLast = chain[std::min(nHeight, chain.Height())];
+    }
+
+    if (pindexLast != pindexTip)
+        LogPrintf("%s: replaying OERU master transactions of blocks %d to %d\n", __FUNCTION__,
+            pindexLast->nHeight + 1, pindexTip->nHeight);
+
+    for (const CBlockIndex *pindex = chain.Next(pindexLast); pindex != NULL; pindex = chain.Next(pindex))
+    {
+        if (!ReplayBlock(pindex, false))
+            return error("%s: failed to read block %d", __FUNCTION__, pindex->nHeight);
+    }
+
+    oeruDB->SetBestBlock(pindexTip->GetBlockHash());
+    return oeruDB->Flush();
+}
+
 bool COeruShield::IsMasterKey(std::vector<unsigned char> addrHash) const
 {
     return Params().OeruShieldMasterKeys().count(addrHash) == 1;
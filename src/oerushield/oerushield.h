@@ -13,6 +13,7 @@
 
 class CBlock;
 class CBlockIndex;
+class CChain;
 class COeruDB;
 class COeruTxOut;
 
@@ -36,15 +37,31 @@ public:
 
     bool IsBlockIdentified(const CBlock *pblock, const int nHeight) const;
     bool IsBlockCertified(const CBlock *pblock, const int nHeight) const;
+    bool IsBlockCertified(const CBlock *pblock, const CBlockIndex *pindex) const;
 
     bool IsMasterKey(CBitcoinAddress addr) const;
     bool IsMasterKey(std::vector<unsigned char> addrHash) const;
+
+    /**
+     * Brings the certified addresses in line with the tip of chain by reverting and
+     * replaying master transactions from the database's best block. Falls back to
+     * replaying everything from the first master transaction height.
+     */
+    bool SyncWithChain(const CChain& chain) const;
 private:
     bool FindOeruVOut(const CTransaction& coinbaseTx, COeruTxOut& oeruTxOut) const;
     bool GetCoinbaseAddress(const CTransaction& coinbaseTx, CBitcoinAddress& coinbaseAddress) const;
     bool GetCoinbaseTx(const CBlock *pblock, CTransaction& coinbaseTx) const;
     bool GetDestinationAddress(const CTxOut txOut, CBitcoinAddress& destination) const;
 
+    /**
+     * Returns whether pindex is identified and by which key. The result is cached on
+     * the block index; pblock may be NULL, in which case it is read from disk if needed.
+     */
+    bool GetIdentityKey(const CBlock *pblock, const CBlockIndex *pindex, CKeyID& keyID) const;
+
+    bool ReplayBlock(const CBlockIndex *pindex, const bool revert) const;
+
     COeruDB* oeruDB = nullptr;
 };
 
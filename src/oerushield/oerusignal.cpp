@@ -4,6 +4,7 @@
 
 #include "oerushield/oerusignal.h"
 
+#include <algorithm>
 #include <string>
 
 #include <event2/event.h>
@@ -11,26 +12,58 @@
 #include <event2/http_compat.h>
 #include <event2/buffer.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/thread.h>
 
 #include "util.h"
+#include "utiltime.h"
 
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
+    struct event_base *base;
     int status;
-    std::string body;
 };
 
 COeruSignal *poeruSignalMain = nullptr;
 
 void COeruSignal::InitOeruSignal(std::string strUAComment)
 {
-    poeruSignalMain = new COeruSignal(strUAComment);
+    int nTimeout = std::max((int)GetArg("-oerusignaltimeout", DEFAULT_OERUSIGNAL_TIMEOUT), 1);
+
+    poeruSignalMain = new COeruSignal(strUAComment, "uasignal.e-gulden.org", 80, nTimeout);
+    if (!poeruSignalMain->Start()) {
+        delete poeruSignalMain;
+        poeruSignalMain = nullptr;
+    }
+}
+
+void COeruSignal::InterruptOeruSignal()
+{
+    if (poeruSignalMain != nullptr)
+        poeruSignalMain->Interrupt();
 }
 
-COeruSignal::COeruSignal(std::string strUAComment)
+void COeruSignal::StopOeruSignal()
+{
+    if (poeruSignalMain != nullptr) {
+        poeruSignalMain->Stop();
+        delete poeruSignalMain;
+        poeruSignalMain = nullptr;
+    }
+}
+
+COeruSignal::COeruSignal(std::string strUAComment, std::string hostname, int port, int nTimeout, size_t nMaxQueueSize)
 {
     this->strUAComment = strUAComment;
+    this->hostname = hostname;
+    this->port = port;
+    this->nTimeout = nTimeout;
+    this->nMaxQueueSize = nMaxQueueSize;
+}
+
+COeruSignal::~COeruSignal()
+{
+    Stop();
 }
 
 std::string COeruSignal::CreateSignalPath(int nBlockHeight)
@@ -45,7 +78,24 @@ std::string COeruSignal::CreateSignalPath(int nBlockHeight)
 
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
-    // Do nothing
+    HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+
+    // req is NULL (or has no response code) on connection errors and timeouts
+    if (req != NULL)
+        reply->status = evhttp_request_get_response_code(req);
+
+    event_base_loopbreak(reply->base);
+}
+
+static void http_deadline_cb(evutil_socket_t, short, void *ctx)
+{
+    LogPrint("OeruSignal", "request deadline reached\n");
+    event_base_loopbreak(static_cast<struct event_base*>(ctx));
+}
+
+static void http_interrupt_cb(evutil_socket_t, short, void *ctx)
+{
+    event_base_loopbreak(static_cast<struct event_base*>(ctx));
 }
 
 bool COeruSignal::ExecuteOeruSignal(int nBlockHeight)
@@ -70,53 +120,184 @@ bool COeruSignal::ExecuteOeruSignal(int nBlockHeight)
 
         this->tLastRequestTime = now;
 
-        struct event_base *base = event_base_new();
-        if (!base) {
-            LogPrint("OeruSignal", "cannot create event_base\n");
-            return false;
-        }
+        return QueueSignal(strPath);
+    } else {
+        return false;
+    }
+}
+
+bool COeruSignal::QueueSignal(const std::string& strPath)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (queue.size() >= nMaxQueueSize) {
+        stats.nDropped++;
+        LogPrint("OeruSignal", "queue full, dropping signal to path %s\n", strPath);
+        return false;
+    }
+
+    queue.push_back(strPath);
+    stats.nQueued++;
+    cond.notify_one();
+    return true;
+}
+
+bool COeruSignal::Start()
+{
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+
+    base = event_base_new();
+    if (!base) {
+        LogPrint("OeruSignal", "cannot create event_base\n");
+        return false;
+    }
+    evInterrupt = event_new(base, -1, 0, http_interrupt_cb, base);
+    if (!evInterrupt) {
+        LogPrint("OeruSignal", "cannot create interrupt event\n");
+        event_base_free(base);
+        base = nullptr;
+        return false;
+    }
 
-        int port = 80;
-        struct evhttp_connection *evcon = evhttp_connection_base_new(base, NULL, this->hostname.c_str(), port);
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = true;
+    }
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "oerusignal",
+                                       boost::function<void()>(boost::bind(&COeruSignal::ThreadOeruSignal, this))));
+    return true;
+}
+
+void COeruSignal::Interrupt()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fRunning = false;
+    cond.notify_all();
+
+    // Abort a request in flight; the event base is thread-safe because
+    // Start() enabled libevent threading before creating it. A bare
+    // loopbreak is forgotten if the worker is not dispatching yet, an
+    // active event stays pending until the next dispatch picks it up.
+    if (evInterrupt)
+        event_active(evInterrupt, EV_TIMEOUT, 0);
+}
+
+void COeruSignal::Stop()
+{
+    Interrupt();
+
+    if (thread.joinable())
+        thread.join();
 
-        if (evcon == NULL) {
-            LogPrint("OeruSignal", "create connection failed\n");
-            return false;
+    if (evInterrupt) {
+        event_free(evInterrupt);
+        evInterrupt = nullptr;
+    }
+    if (base) {
+        event_base_free(base);
+        base = nullptr;
+    }
+}
+
+COeruSignalStats COeruSignal::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    COeruSignalStats result = stats;
+    result.nQueueSize = queue.size();
+    return result;
+}
+
+void COeruSignal::ThreadOeruSignal()
+{
+    while (true) {
+        std::string strPath;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (fRunning && queue.empty())
+                cond.wait(lock);
+            if (!fRunning)
+                break;
+            strPath = queue.front();
+            queue.pop_front();
         }
 
-        HTTPReply response;
-        struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response);
+        int64_t nStart = GetTimeMicros();
+        bool fSent = SendSignal(strPath);
+        int64_t nLatency = GetTimeMicros() - nStart;
 
-        if (req == NULL) {
-            LogPrint("OeruSignal", "create request failed\n");
-            return false;
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fSent) {
+            stats.nSent++;
+            stats.nLastLatency = nLatency;
+            stats.nTotalLatency += nLatency;
+        } else {
+            stats.nFailed++;
         }
+    }
+}
 
-        struct evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
-        assert(output_headers);
+bool COeruSignal::SendSignal(const std::string& strPath)
+{
+    struct evhttp_connection *evcon = evhttp_connection_base_new(base, NULL, this->hostname.c_str(), this->port);
 
-        evhttp_add_header(output_headers, "Host", this->hostname.c_str());
+    if (evcon == NULL) {
+        LogPrint("OeruSignal", "create connection failed\n");
+        return false;
+    }
 
-        LogPrint("OeruSignal", "Preparing to send signal to path %s\n",
-            strPath.c_str());
+    // Covers both connecting and waiting for the response, never retry
+    evhttp_connection_set_timeout(evcon, this->nTimeout);
+    evhttp_connection_set_retries(evcon, 0);
 
-        int r = evhttp_make_request(evcon, req, EVHTTP_REQ_GET, strPath.c_str());
-        if (r != 0) {
-            evhttp_connection_free(evcon);
-            event_base_free(base);
+    HTTPReply response;
+    response.base = base;
+    response.status = 0;
+    struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response);
 
-            LogPrint("OeruSignal", "send request failed\n");
-            return false;
-        }
+    if (req == NULL) {
+        evhttp_connection_free(evcon);
+        LogPrint("OeruSignal", "create request failed\n");
+        return false;
+    }
+
+    struct evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
+    assert(output_headers);
+
+    evhttp_add_header(output_headers, "Host", this->hostname.c_str());
+    evhttp_add_header(output_headers, "Connection", "close");
 
-        LogPrint("OeruSignal", "Sent uasignal successfully!\n");
+    LogPrint("OeruSignal", "Preparing to send signal to path %s\n",
+        strPath.c_str());
 
-        event_base_dispatch(base);
+    int r = evhttp_make_request(evcon, req, EVHTTP_REQ_GET, strPath.c_str());
+    if (r != 0) {
         evhttp_connection_free(evcon);
-        event_base_free(base);
 
-        return true;
-    } else {
+        LogPrint("OeruSignal", "send request failed\n");
         return false;
     }
+
+    // The connection timeout only applies to inactivity, this puts a hard
+    // limit on the total time a single signal may take
+    struct event *deadline = evtimer_new(base, http_deadline_cb, base);
+    struct timeval tv;
+    tv.tv_sec = this->nTimeout;
+    tv.tv_usec = 0;
+    evtimer_add(deadline, &tv);
+
+    event_base_dispatch(base);
+
+    event_free(deadline);
+    evhttp_connection_free(evcon);
+
+    if (response.status == 0) {
+        LogPrint("OeruSignal", "signal to path %s failed\n", strPath.c_str());
+        return false;
+    }
+
+    LogPrint("OeruSignal", "Sent uasignal successfully! (HTTP %d)\n", response.status);
+    return true;
 }
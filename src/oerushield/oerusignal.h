@@ -5,23 +5,95 @@
 #ifndef BITCOIN_OERUSHIELD_OERUSIGNAL_H
 #define BITCOIN_OERUSHIELD_OERUSIGNAL_H
 
+#include "sync.h"
+
 #include <ctime>
+#include <deque>
+#include <stdint.h>
 #include <string>
 
+#include <boost/thread.hpp>
+
+struct event;
+struct event_base;
+
+/** Default timeout (in seconds) for connecting to and hearing back from the signal host */
+static const int DEFAULT_OERUSIGNAL_TIMEOUT = 10;
+/** Default number of signals that may be waiting to be sent */
+static const size_t DEFAULT_OERUSIGNAL_QUEUE = 8;
+
+/** Counters describing the state of the signal dispatcher */
+struct COeruSignalStats
+{
+    uint64_t nQueued = 0;
+    uint64_t nSent = 0;
+    uint64_t nFailed = 0;
+    uint64_t nDropped = 0;
+    size_t nQueueSize = 0;
+    int64_t nLastLatency = 0;   // in microseconds
+    int64_t nTotalLatency = 0;  // in microseconds, summed over all sent signals
+};
+
+/**
+ * Sends a small HTTP beacon to the signal host every few blocks.
+ *
+ * ExecuteOeruSignal() is called from AcceptBlock() while holding cs_main, so
+ * it only decides whether a signal is due and queues it. The actual request
+ * is made by a dedicated worker thread on its own event base, bounded by a
+ * strict timeout. When the queue is full new signals are dropped.
+ */
 class COeruSignal
 {
 public:
     static void InitOeruSignal(std::string strUAComment);
+    static void InterruptOeruSignal();
+    static void StopOeruSignal();
 
-    COeruSignal(std::string strUAComment);
+    COeruSignal(std::string strUAComment,
+                std::string hostname = "uasignal.e-gulden.org",
+                int port = 80,
+                int nTimeout = DEFAULT_OERUSIGNAL_TIMEOUT,
+                size_t nMaxQueueSize = DEFAULT_OERUSIGNAL_QUEUE);
+    ~COeruSignal();
 
     std::string CreateSignalPath(int nBlockHeight);
     bool ExecuteOeruSignal(int nBlockHeight);
+
+    /** Queue a request for path, returns false if it was dropped */
+    bool QueueSignal(const std::string& strPath);
+
+    /** Start the worker thread */
+    bool Start();
+    /** Wake up the worker thread and abort any request in flight */
+    void Interrupt();
+    /** Interrupt and wait for the worker thread to exit */
+    void Stop();
+
+    COeruSignalStats GetStats() const;
 private:
-    std::string hostname = "uasignal.e-gulden.org";
+    void ThreadOeruSignal();
+    bool SendSignal(const std::string& strPath);
+
+    std::string hostname;
+    int port;
+    int nTimeout;
+    size_t nMaxQueueSize;
+
     std::string strUAComment;
     int nNextOeruSignalExecutionHeight = 0;
     std::time_t tLastRequestTime = 0;
+
+    /** Protects the queue, the stats and fRunning */
+    mutable CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    std::deque<std::string> queue;
+    COeruSignalStats stats;
+    bool fRunning = false;
+
+    struct event_base *base = nullptr;
+    //! Activated by Interrupt() to break out of the dispatch of a request
+    struct event *evInterrupt = nullptr;
+    boost::thread thread;
 };
 
 extern COeruSignal* poeruSignalMain;
@@ -14,6 +14,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+
 uint256 CBlockHeader::GetHash() const
 {
     return SerializeHash(*this);
@@ -26,6 +28,23 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+void CBlockHeader::GetPoWHashes(const CBlockHeader* const* headers, uint256* hashes, unsigned int n, char* scratchpad)
+{
+    const char* inputs[SCRYPT_MAX_WAYS];
+    char* outputs[SCRYPT_MAX_WAYS];
+    while (n > 0) {
+        unsigned int nNow = std::min(n, (unsigned int)SCRYPT_MAX_WAYS);
+        for (unsigned int i = 0; i < nNow; i++) {
+            inputs[i] = BEGIN(headers[i]->nVersion);
+            outputs[i] = BEGIN(hashes[i]);
+        }
+        scrypt_1024_1_1_256_sp_multi(inputs, outputs, nNow, scratchpad);
+        headers += nNow;
+        hashes += nNow;
+        n -= nNow;
+    }
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -64,6 +64,12 @@ public:
 
     uint256 GetPoWHash() const;
 
+    /**
+     * Compute the PoW hashes of n headers with the multi-lane scrypt kernel.
+     * scratchpad must be SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+     */
+    static void GetPoWHashes(const CBlockHeader* const* headers, uint256* hashes, unsigned int n, char* scratchpad);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -15,12 +15,15 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
+#include "jsonwriter.h"
 #include "oerushield/oerudb.h"
 #include "oerushield/oerushield.h"
+#include "oerushield/oerusignal.h"
 
 #include <stdint.h>
 
@@ -92,7 +95,26 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToJSON(tx, uint256(), objTx);
+    return objTx;
+}
+
+//! The "tx" field of blockToJSON, which needs no lock
+static UniValue blockTxsToJSON(const CBlock& block, bool txDetails)
+{
+    UniValue txs(UniValue::VARR);
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        txs.push_back(blockTxToJSON(tx, txDetails));
+    return txs;
+}
+
+//! blockToJSON, with the given "tx" field
+static UniValue blockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, const UniValue& txs)
 {
     COeruShield oeruShield(poeruDBMain);
 
@@ -113,18 +135,6 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("certified", oeruShield.IsBlockCertified(&block, blockindex->nHeight)));
     result.push_back(Pair("oeru_height", oeruShield.GetBlocksSinceLastCertified(&block, blockindex)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
-    }
     result.push_back(Pair("tx", txs));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
@@ -141,6 +151,39 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    return blockFieldsToJSON(block, blockindex, blockTxsToJSON(block, txDetails));
+}
+
+/** Write blockToJSON to writer one transaction at a time. Takes cs_main only
+ *  for the fields about the block itself. */
+void blockToJSONStream(CJSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue fields;
+    {
+        LOCK(cs_main);
+        fields = blockFieldsToJSON(block, blockindex, UniValue(UniValue::VARR));
+    }
+    std::vector<std::string> keys = fields.getKeys();
+    writer.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] != "tx") {
+            writer.Write(keys[i], fields[i]);
+            continue;
+        }
+        writer.Key(keys[i]);
+        writer.BeginArray();
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            writer.Write(blockTxToJSON(tx, txDetails));
+            if (!writer.MaybeFlush())
+                return;
+        }
+        writer.EndArray();
+    }
+    writer.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -274,17 +317,58 @@ UniValue getoerucertifiedaddresses(const UniValue &params, bool fHelp)
     return obj;
 }
 
+UniValue getoerusignalinfo(const UniValue &params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getoerusignalinfo\n"
+            "Returns statistics of the OeruSignal dispatcher.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,  (boolean) Whether OeruSignal is running (requires -uacomment)\n"
+            "  \"queued\": n,            (numeric) Number of signals queued since startup\n"
+            "  \"sent\": n,              (numeric) Number of signals that received a response\n"
+            "  \"failed\": n,            (numeric) Number of signals that failed or timed out\n"
+            "  \"dropped\": n,           (numeric) Number of signals dropped because the queue was full\n"
+            "  \"queuesize\": n,         (numeric) Number of signals currently waiting to be sent\n"
+            "  \"lastlatency\": n,       (numeric) Duration of the last sent signal in milliseconds\n"
+            "  \"avglatency\": n         (numeric) Average duration of sent signals in milliseconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getoerusignalinfo", "")
+            + HelpExampleRpc("getoerusignalinfo", "")
+        );
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("enabled", poeruSignalMain != nullptr));
+    if (poeruSignalMain == nullptr)
+        return obj;
+
+    COeruSignalStats stats = poeruSignalMain->GetStats();
+    obj.push_back(Pair("queued", stats.nQueued));
+    obj.push_back(Pair("sent", stats.nSent));
+    obj.push_back(Pair("failed", stats.nFailed));
+    obj.push_back(Pair("dropped", stats.nDropped));
+    obj.push_back(Pair("queuesize", (uint64_t)stats.nQueueSize));
+    obj.push_back(Pair("lastlatency", stats.nLastLatency * 0.001));
+    obj.push_back(Pair("avglatency", stats.nSent ? stats.nTotalLatency * 0.001 / stats.nSent : 0.0));
+
+    return obj;
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
     {
         LOCK(mempool.cs);
+        // In the order of queryHashes, like mempoolToJSONStream
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        BOOST_FOREACH(const uint256& hash, vtxid)
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, *mempool.mapTx.find(hash));
             o.push_back(Pair(hash.ToString(), info));
         }
         return o;
@@ -302,6 +386,45 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+/** Write mempoolToJSON to writer. The verbose form is written in chunks with
+ *  mempool.cs held for one chunk at a time, so transactions that leave the
+ *  mempool in between are left out. */
+void mempoolToJSONStream(CJSONWriter& writer, bool fVerbose = false)
+{
+    vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    if (!fVerbose) {
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid) {
+            writer.Write(hash.ToString());
+            if (!writer.MaybeFlush())
+                return;
+        }
+        writer.EndArray();
+        return;
+    }
+
+    writer.BeginObject();
+    vector<uint256>::const_iterator it = vtxid.begin();
+    while (it != vtxid.end()) {
+        {
+            LOCK(mempool.cs);
+            for (; it != vtxid.end() && !writer.IsChunkFull(); ++it) {
+                CTxMemPool::txiter entry = mempool.mapTx.find(*it);
+                if (entry == mempool.mapTx.end())
+                    continue;
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(info, *entry);
+                writer.Write(it->ToString(), info);
+            }
+        }
+        if (!writer.MaybeFlush())
+            return;
+    }
+    writer.EndObject();
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -333,6 +456,19 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     return mempoolToJSON(fVerbose);
 }
 
+static bool getrawmempool_stream(const UniValue& params, CJSONWriter& writer)
+{
+    if (params.size() > 1)
+        return false;
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    mempoolToJSONStream(writer, fVerbose);
+    return true;
+}
+
 UniValue getmempoolancestors(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2) {
@@ -578,6 +714,43 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+/** Find a block for RPC, and where to read it from without holding cs_main */
+static CBlockIndex* LookupBlockForRPC(const std::string& strHash, CDiskBlockPos& pos, bool& fCheckPOW)
+{
+    AssertLockHeld(cs_main);
+
+    uint256 hash(uint256S(strHash));
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    pos = pblockindex->GetBlockPos();
+    // As in ReadBlockFromDisk(CBlock&, const CBlockIndex*, ...)
+    fCheckPOW = (pblockindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_HEADER;
+    return pblockindex;
+}
+
+static CBlockIndex* ReadBlockForRPC(const std::string& strHash, CBlock& block)
+{
+    CBlockIndex* pblockindex;
+    CDiskBlockPos pos;
+    bool fCheckPOW;
+    {
+        LOCK(cs_main);
+        pblockindex = LookupBlockForRPC(strHash, pos, fCheckPOW);
+    }
+
+    // The block may have been pruned in the meantime, then the read fails
+    if (!ReadBlockFromDisk(block, pos, Params().GetConsensus(), fCheckPOW) || block.GetHash() != pblockindex->GetBlockHash())
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -619,26 +792,12 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "\"e2acdf2dd19a702e5d12a925f1e984b01e47a933562ca893656d4afb38b44ee3\"")
         );
 
-    LOCK(cs_main);
-
-    std::string strHash = params[0].get_str();
-    uint256 hash(uint256S(strHash));
-
     bool fVerbose = true;
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(params[0].get_str(), block);
 
     if (!fVerbose)
     {
@@ -648,7 +807,21 @@ UniValue getblock(const UniValue& params, bool fHelp)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex);
+    UniValue txs = blockTxsToJSON(block, false);
+    LOCK(cs_main);
+    return blockFieldsToJSON(block, pblockindex, txs);
+}
+
+static bool getblock_stream(const UniValue& params, CJSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2 || (params.size() > 1 && !params[1].get_bool()))
+        return false;
+
+    CBlock block;
+    CBlockIndex* pblockindex = ReadBlockForRPC(params[0].get_str(), block);
+
+    blockToJSONStream(writer, block, pblockindex);
+    return true;
 }
 
 struct CCoinsStats
@@ -664,6 +837,21 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    ss << hash;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        uint32_t nPos = it->first + 1;
+        stats.nTransactionOutputs++;
+        ss << VARINT(nPos);
+        ss << it->second.out;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
@@ -676,32 +864,31 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    // The outputs of a transaction are hashed together, in the same way as
+    // when they were stored as a single entry
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
             stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -745,6 +932,49 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue getchainstateflushinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getchainstateflushinfo\n"
+            "\nReturns statistics about the writes of the UTXO set cache to disk.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"flushes\": n,             (numeric) The number of completed writes since startup\n"
+            "  \"pending\": n,             (numeric) The number of changed outputs still being written\n"
+            "  \"pending_usage\": n,       (numeric) The memory taken by the outputs still being written\n"
+            "  \"last_time\": ttt,         (numeric) The time of the last completed write in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"last_txouts\": n,         (numeric) The number of changed outputs in the last write\n"
+            "  \"last_bytes\": n,          (numeric) The size of the last write\n"
+            "  \"last_duration\": x.xxx,   (numeric) The duration of the last write in seconds\n"
+            "  \"total_bytes\": n,         (numeric) The size of all writes\n"
+            "  \"total_duration\": x.xxx,  (numeric) The duration of all writes in seconds\n"
+            "  \"total_wait\": x.xxx       (numeric) The time validation was blocked waiting for writes in seconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getchainstateflushinfo", "")
+            + HelpExampleRpc("getchainstateflushinfo", "")
+        );
+
+    LOCK(cs_main);
+    if (pcoinsflusher == NULL)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set is not written in the background");
+    CCoinsFlushStats stats = pcoinsflusher->GetStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("flushes", (int64_t)stats.nFlushes));
+    ret.push_back(Pair("pending", (int64_t)stats.nPendingCoins));
+    ret.push_back(Pair("pending_usage", (int64_t)stats.nPendingUsage));
+    ret.push_back(Pair("last_time", stats.nLastTime));
+    ret.push_back(Pair("last_txouts", (int64_t)stats.nLastCoins));
+    ret.push_back(Pair("last_bytes", (int64_t)stats.nLastBytes));
+    ret.push_back(Pair("last_duration", 0.000001 * stats.nLastDuration));
+    ret.push_back(Pair("total_bytes", (int64_t)stats.nTotalBytes));
+    ret.push_back(Pair("total_duration", 0.000001 * stats.nTotalDuration));
+    ret.push_back(Pair("total_wait", 0.000001 * stats.nTotalWait));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -770,7 +1000,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -783,44 +1012,45 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             + HelpExampleRpc("gettxout", "\"txid\", 1")
         );
 
-    LOCK(cs_main);
-
-    UniValue ret(UniValue::VOBJ);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
     int n = params[1].get_int();
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
     bool fMempool = true;
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
-            return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
-    } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
-            return NullUniValue;
+    Coin coin;
+    CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        if (fMempool) {
+            LOCK(mempool.cs);
+            CCoinsViewMemPool view(pcoinsTip, mempool);
+            if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
+                return NullUniValue;
+        } else {
+            if (!pcoinsTip->GetCoin(out, coin))
+                return NullUniValue;
+        }
+
+        BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+        pindex = it->second;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
-    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-    CBlockIndex *pindex = it->second;
+    UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1222,29 +1452,31 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                         actor (function)            okSafeMode
-  //  --------------------- ---------------------------- --------------------------- ----------
-    { "blockchain",         "getbestblockhash",          &getbestblockhash,          true  },
-    { "blockchain",         "getblock",                  &getblock,                  true  },
-    { "blockchain",         "getblockchaininfo",         &getblockchaininfo,         true  },
-    { "blockchain",         "getblockcount",             &getblockcount,             true  },
-    { "blockchain",         "getblockhash",              &getblockhash,              true  },
-    { "blockchain",         "getblockheader",            &getblockheader,            true  },
-    { "blockchain",         "getchaintips",              &getchaintips,              true  },
-    { "blockchain",         "getdifficulty",             &getdifficulty,             true  },
-    { "blockchain",         "getmempoolancestors",       &getmempoolancestors,       true  },
-    { "blockchain",         "getmempooldescendants",     &getmempooldescendants,     true  },
-    { "blockchain",         "getmempoolentry",           &getmempoolentry,           true  },
-    { "blockchain",         "getmempoolinfo",            &getmempoolinfo,            true  },
-    { "blockchain",         "getoerucertifiedaddresses", &getoerucertifiedaddresses, true  },
-    { "blockchain",         "getrawmempool",             &getrawmempool,             true  },
-    { "blockchain",         "gettxout",                  &gettxout,                  true  },
-    { "blockchain",         "gettxoutsetinfo",           &gettxoutsetinfo,           true  },
-    { "blockchain",         "verifychain",               &verifychain,               true  },
+{ //  category              name                         actor (function)            okSafeMode okParallel streamActor
+  //  --------------------- ---------------------------- --------------------------- ---------- ---------- ----------------------
+    { "blockchain",         "getbestblockhash",          &getbestblockhash,          true,      true,      NULL },
+    { "blockchain",         "getblock",                  &getblock,                  true,      true,      &getblock_stream },
+    { "blockchain",         "getblockchaininfo",         &getblockchaininfo,         true,      false,     NULL },
+    { "blockchain",         "getblockcount",             &getblockcount,             true,      true,      NULL },
+    { "blockchain",         "getblockhash",              &getblockhash,              true,      true,      NULL },
+    { "blockchain",         "getblockheader",            &getblockheader,            true,      true,      NULL },
+    { "blockchain",         "getchainstateflushinfo",    &getchainstateflushinfo,    true,      false,     NULL },
+    { "blockchain",         "getchaintips",              &getchaintips,              true,      false,     NULL },
+    { "blockchain",         "getdifficulty",             &getdifficulty,             true,      false,     NULL },
+    { "blockchain",         "getmempoolancestors",       &getmempoolancestors,       true,      false,     NULL },
+    { "blockchain",         "getmempooldescendants",     &getmempooldescendants,     true,      false,     NULL },
+    { "blockchain",         "getmempoolentry",           &getmempoolentry,           true,      true,      NULL },
+    { "blockchain",         "getmempoolinfo",            &getmempoolinfo,            true,      false,     NULL },
+    { "blockchain",         "getoerucertifiedaddresses", &getoerucertifiedaddresses, true,      false,     NULL },
+    { "blockchain",         "getoerusignalinfo",         &getoerusignalinfo,         true,      false,     NULL },
+    { "blockchain",         "getrawmempool",             &getrawmempool,             true,      false,     &getrawmempool_stream },
+    { "blockchain",         "gettxout",                  &gettxout,                  true,      true,      NULL },
+    { "blockchain",         "gettxoutsetinfo",           &gettxoutsetinfo,           true,      false,     NULL },
+    { "blockchain",         "verifychain",               &verifychain,               true,      false,     NULL },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      false,     NULL },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      false,     NULL },
 };
 
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
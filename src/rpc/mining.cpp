@@ -11,6 +11,7 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/scrypt.h"
 #include "init.h"
 #include "main.h"
 #include "miner.h"
@@ -22,10 +23,12 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <atomic>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -95,12 +98,102 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
     return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
 }
 
-UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
+/** Maximum number of threads generate and generatetoaddress may use */
+static const int MAX_GENERATE_THREADS = 64;
+
+/** Hash rate of the last generate or generatetoaddress call */
+static std::atomic<int64_t> nLastGenerateHashesPerSec(0);
+
+/** State shared by the threads searching the nonce range of one block */
+struct CNonceSearch
+{
+    CBlockHeader header;
+    //! Exclusive end of the nonce range
+    uint32_t nEnd;
+    //! Start of the next batch of nonces to hand out
+    std::atomic<uint32_t> nNext;
+    //! Lowest nonce found so far that solves the block, nEnd if none
+    std::atomic<uint32_t> nFound;
+    std::atomic<uint64_t> nHashes;
+
+    CNonceSearch(const CBlockHeader& headerIn, uint32_t nEndIn) :
+        header(headerIn), nEnd(nEndIn), nNext(headerIn.nNonce), nFound(nEndIn), nHashes(0) {}
+};
+
+/**
+ * Nonces are handed out in ascending batches of the scrypt lane width. A
+ * thread stops once the next batch starts above a known solution, so the
+ * lowest solution wins and the result matches a single threaded search.
+ */
+static void ThreadNonceSearch(CNonceSearch* search)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const unsigned int nWays = std::min(scrypt_multi_ways(), (unsigned int)SCRYPT_MAX_WAYS);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+
+    CBlockHeader headers[SCRYPT_MAX_WAYS];
+    const CBlockHeader* vpheader[SCRYPT_MAX_WAYS];
+    uint256 hashes[SCRYPT_MAX_WAYS];
+    for (unsigned int i = 0; i < nWays; i++) {
+        headers[i] = search->header;
+        vpheader[i] = &headers[i];
+    }
+
+    while (true) {
+        uint32_t nStart = search->nNext.fetch_add(nWays);
+        if (nStart >= search->nEnd || nStart >= search->nFound)
+            break;
+
+        unsigned int n = std::min(nWays, search->nEnd - nStart);
+        for (unsigned int i = 0; i < n; i++)
+            headers[i].nNonce = nStart + i;
+        CBlockHeader::GetPoWHashes(vpheader, hashes, n, &scratchpad[0]);
+        search->nHashes += n;
+
+        for (unsigned int i = 0; i < n; i++) {
+            if (CheckProofOfWork(hashes[i], headers[i].nBits, consensusParams)) {
+                uint32_t nFound = search->nFound;
+                while (nStart + i < nFound && !search->nFound.compare_exchange_weak(nFound, nStart + i)) {}
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Try the nonces from header.nNonce up to nEnd (exclusive) and return the
+ * first one that solves the block, or nEnd if there is none.
+ */
+static uint32_t FindNonce(CBlockHeader header, uint32_t nEnd, int nThreads, uint64_t& nHashes)
+{
+    if (nThreads <= 1) {
+        while (header.nNonce < nEnd) {
+            nHashes++;
+            if (CheckProofOfWork(header.GetPoWHash(), header.nBits, Params().GetConsensus()))
+                break;
+            ++header.nNonce;
+        }
+        return header.nNonce;
+    }
+
+    CNonceSearch search(header, nEnd);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadNonceSearch, &search));
+    threadGroup.join_all();
+
+    nHashes += search.nHashes;
+    return search.nFound;
+}
+
+UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript, int nThreads)
 {
     static const int nInnerLoopCount = 0x10000;
     int nHeightStart = 0;
     int nHeightEnd = 0;
     int nHeight = 0;
+    uint64_t nHashes = 0;
+    int64_t nTimeStart = GetTimeMicros();
 
     {   // Don't keep cs_main locked
         LOCK(cs_main);
@@ -120,10 +213,10 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
+        uint32_t nEnd = std::min((uint64_t)nInnerLoopCount, pblock->nNonce + nMaxTries);
+        uint32_t nNonce = FindNonce(*pblock, nEnd, nThreads, nHashes);
+        nMaxTries -= nNonce - pblock->nNonce;
+        pblock->nNonce = nNonce;
         if (nMaxTries == 0) {
             break;
         }
@@ -142,23 +235,46 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
             coinbaseScript->KeepScript();
         }
     }
+
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    if (nTime > 0)
+        nLastGenerateHashesPerSec = nHashes * 1000000 / nTime;
+    LogPrint("bench", "generate: %d blocks, %u hashes in %.2fms using %d threads (%d hashes/s)\n",
+        nHeight - nHeightStart, nHashes, nTime * 0.001, nThreads, nLastGenerateHashesPerSec.load());
+
     return blockHashes;
 }
 
+/** Parse the optional threads argument of generate and generatetoaddress */
+static int ParseGenerateThreads(const UniValue& params, unsigned int nPos)
+{
+    if (params.size() <= nPos)
+        return 1;
+    int nThreads = params[nPos].get_int();
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    if (nThreads < 1 || nThreads > MAX_GENERATE_THREADS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid number of threads, must be between 1 and %d", MAX_GENERATE_THREADS));
+    return nThreads;
+}
+
 UniValue generate(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 2)
+    if (fHelp || params.size() < 1 || params.size() > 3)
         throw runtime_error(
-            "generate numblocks ( maxtries )\n"
+            "generate numblocks ( maxtries threads )\n"
             "\nMine up to numblocks blocks immediately (before the RPC call returns)\n"
             "\nArguments:\n"
             "1. numblocks    (numeric, required) How many blocks are generated immediately.\n"
             "2. maxtries     (numeric, optional) How many iterations to try (default = 1000000).\n"
+            "3. threads      (numeric, optional) How many threads to search nonces with (default = 1, 0 = all cores).\n"
             "\nResult\n"
             "[ blockhashes ]     (array) hashes of blocks generated\n"
             "\nExamples:\n"
             "\nGenerate 11 blocks\n"
             + HelpExampleCli("generate", "11")
+            + "\nGenerate 11 blocks using 4 threads\n"
+            + HelpExampleCli("generate", "11 1000000 4")
         );
 
     int nGenerate = params[0].get_int();
@@ -178,19 +294,20 @@ UniValue generate(const UniValue& params, bool fHelp)
     if (coinbaseScript->reserveScript.empty())
         throw JSONRPCError(RPC_INTERNAL_ERROR, "No coinbase script available (mining requires a wallet)");
 
-    return generateBlocks(coinbaseScript, nGenerate, nMaxTries, true);
+    return generateBlocks(coinbaseScript, nGenerate, nMaxTries, true, ParseGenerateThreads(params, 2));
 }
 
 UniValue generatetoaddress(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 2 || params.size() > 3)
+    if (fHelp || params.size() < 2 || params.size() > 4)
         throw runtime_error(
-            "generatetoaddress numblocks address (maxtries)\n"
+            "generatetoaddress numblocks address ( maxtries threads )\n"
             "\nMine blocks immediately to a specified address (before the RPC call returns)\n"
             "\nArguments:\n"
             "1. numblocks    (numeric, required) How many blocks are generated immediately.\n"
             "2. address    (string, required) The address to send the newly generated litecoin to.\n"
             "3. maxtries     (numeric, optional) How many iterations to try (default = 1000000).\n"
+            "4. threads      (numeric, optional) How many threads to search nonces with (default = 1, 0 = all cores).\n"
             "\nResult\n"
             "[ blockhashes ]     (array) hashes of blocks generated\n"
             "\nExamples:\n"
@@ -211,7 +328,7 @@ UniValue generatetoaddress(const UniValue& params, bool fHelp)
     boost::shared_ptr<CReserveScript> coinbaseScript(new CReserveScript());
     coinbaseScript->reserveScript = GetScriptForDestination(address.Get());
 
-    return generateBlocks(coinbaseScript, nGenerate, nMaxTries, false);
+    return generateBlocks(coinbaseScript, nGenerate, nMaxTries, false, ParseGenerateThreads(params, 3));
 }
 
 UniValue getmininginfo(const UniValue& params, bool fHelp)
@@ -229,6 +346,7 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"difficulty\": xxx.xxxxx    (numeric) The current difficulty\n"
             "  \"errors\": \"...\"            (string) Current errors\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
+            "  \"generatehashps\": nnn,     (numeric) The hashes per second of the last generate call\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -249,6 +367,7 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(params, false)));
+    obj.push_back(Pair("generatehashps",   nLastGenerateHashesPerSec.load()));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
@@ -316,6 +435,15 @@ std::string gbt_vb_name(const Consensus::DeploymentPos pos) {
     return s;
 }
 
+//! The template of getblocktemplate, kept up to date with the mempool as transactions come and go
+static std::unique_ptr<CBlockTemplateUpdater> ptemplateupdater;
+
+void StopBlockTemplateUpdater()
+{
+    LOCK(cs_main);
+    ptemplateupdater.reset();
+}
+
 UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -469,28 +597,29 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Litecoin is downloading blocks...");
 
-    static unsigned int nTransactionsUpdatedLast;
+    if (!ptemplateupdater)
+        ptemplateupdater.reset(new CBlockTemplateUpdater(Params(), CScript() << OP_TRUE));
 
     if (!lpval.isNull())
     {
         // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
         uint256 hashWatchedChain;
         boost::system_time checktxtime;
-        unsigned int nTransactionsUpdatedLastLP;
+        uint64_t nChangesLP;
 
         if (lpval.isStr())
         {
-            // Format: <hashBestChain><nTransactionsUpdatedLast>
+            // Format: <hashBestChain><nChanges>
             std::string lpstr = lpval.get_str();
 
             hashWatchedChain.SetHex(lpstr.substr(0, 64));
-            nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            nChangesLP = atoi64(lpstr.substr(64));
         }
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            nChangesLP = ptemplateupdater->GetChangesApplied();
         }
 
         // Release the wallet and main lock while waiting
@@ -504,7 +633,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
                 if (!cvBlockChange.timed_wait(lock, checktxtime))
                 {
                     // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
+                    if (ptemplateupdater->GetChanges() != nChangesLP)
                         break;
                     checktxtime += boost::posix_time::seconds(10);
                 }
@@ -518,34 +647,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     }
 
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    CBlockTemplate* pblocktemplate = ptemplateupdater->Get();
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    CBlockIndex* pindexPrev = chainActive.Tip();
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -667,7 +772,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
-    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
+    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(ptemplateupdater->GetChangesApplied())));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
     result.push_back(Pair("mutable", aMutable));
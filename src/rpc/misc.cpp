@@ -5,6 +5,7 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "httpserver.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
@@ -417,6 +418,51 @@ UniValue signmessagewithprivkey(const UniValue& params, bool fHelp)
     return EncodeBase64(&vchSig[0], vchSig.size());
 }
 
+UniValue gethttpinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gethttpinfo\n"
+            "\nReturns statistics of the HTTP server that serves RPC and REST requests.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"eventthreads\": n,        (numeric) Number of threads accepting connections and reading requests\n"
+            "  \"eventrequests\": [n,...], (array) Number of requests read by each of them\n"
+            "  \"workqueue\": n,           (numeric) Number of requests waiting for a worker thread\n"
+            "  \"workqueuemax\": n,        (numeric) Maximum number of requests waiting, see -rpcworkqueue\n"
+            "  \"workqueuepeak\": n,       (numeric) Highest number of requests that were waiting\n"
+            "  \"requests\": n,            (numeric) Number of requests handled by the worker threads\n"
+            "  \"rejected\": n,            (numeric) Number of requests turned away because the work queue was full\n"
+            "  \"avgqueuetime\": x.xxx,    (numeric) Average time requests waited for a worker thread in milliseconds\n"
+            "  \"maxqueuetime\": x.xxx,    (numeric) Longest time a request waited for a worker thread in milliseconds\n"
+            "  \"avghandletime\": x.xxx,   (numeric) Average time spent handling a request in milliseconds\n"
+            "  \"maxhandletime\": x.xxx    (numeric) Longest time spent handling a request in milliseconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gethttpinfo", "")
+            + HelpExampleRpc("gethttpinfo", "")
+        );
+
+    HTTPStats stats = GetHTTPStats();
+    UniValue eventRequests(UniValue::VARR);
+    BOOST_FOREACH(uint64_t nRequests, stats.vEventThreadRequests)
+        eventRequests.push_back(nRequests);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("eventthreads", stats.nEventThreads));
+    obj.push_back(Pair("eventrequests", eventRequests));
+    obj.push_back(Pair("workqueue", (uint64_t)stats.nWorkQueueDepth));
+    obj.push_back(Pair("workqueuemax", (uint64_t)stats.nWorkQueueMaxDepth));
+    obj.push_back(Pair("workqueuepeak", (uint64_t)stats.nWorkQueuePeakDepth));
+    obj.push_back(Pair("requests", stats.nRequests));
+    obj.push_back(Pair("rejected", stats.nRejected));
+    obj.push_back(Pair("avgqueuetime", stats.nRequests ? stats.nTotalQueueTime * 0.001 / stats.nRequests : 0.0));
+    obj.push_back(Pair("maxqueuetime", stats.nMaxQueueTime * 0.001));
+    obj.push_back(Pair("avghandletime", stats.nRequests ? stats.nTotalHandleTime * 0.001 / stats.nRequests : 0.0));
+    obj.push_back(Pair("maxhandletime", stats.nMaxHandleTime * 0.001));
+    return obj;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -452,6 +498,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
+    { "control",            "gethttpinfo",            &gethttpinfo,            true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "verifymessage",          &verifymessage,          true  },
@@ -409,11 +409,138 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * A helper is only queued for every this many read-only calls in a row, so
+ * that the thread executing the batch runs short stretches by itself instead
+ * of taking work queue slots for them.
+ */
+static const size_t RPC_BATCH_CALLS_PER_HELPER = 4;
+
+/** Whether req may run alongside the requests around it in a batch */
+static bool JSONRPCCanRunInParallel(const UniValue& req)
 {
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    if (!method.isStr())
+        return false;
+    const CRPCCommand* pcmd = tableRPC[method.get_str()];
+    return pcmd && pcmd->okParallel;
+}
+
+/**
+ * Calls of a batch that are being executed in parallel. The thread executing
+ * the batch takes part, so the calls get done even when no other thread
+ * comes to help; helpers arriving late help with the next stretch of calls,
+ * or find nothing left and return.
+ */
+class CRPCParallelCalls
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    const UniValue& vReq;
+    std::vector<UniValue>& vResults;
+    //! The calls left to start, and the end of the calls to run in parallel
+    size_t nNext;
+    size_t nEnd;
+    int nActive;
+    int nMaxActive;
+    //! Helpers queued that have not started yet
+    int nQueued;
+
+public:
+    CRPCParallelCalls(const UniValue& vReqIn, std::vector<UniValue>& vResultsIn, int nMaxActiveIn) :
+        vReq(vReqIn), vResults(vResultsIn), nNext(0), nEnd(0), nActive(0), nMaxActive(nMaxActiveIn), nQueued(0) {}
+
+    /** Set the calls [nBegin, nEndIn) to be run. The previous ones must be done. */
+    void Start(size_t nBegin, size_t nEndIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        nNext = nBegin;
+        nEnd = nEndIn;
+    }
+
+    /** Queue helpers with queueWork, so that nHelpers are waiting to start */
+    static void QueueHelpers(const boost::shared_ptr<CRPCParallelCalls>& calls, int nHelpers, const RPCQueueWorkFn& queueWork)
+    {
+        boost::unique_lock<boost::mutex> lock(calls->cs);
+        // Helpers queued here may start, and stop counting, right away
+        int nMissing = nHelpers - calls->nQueued;
+        for (int i = 0; i < nMissing; i++) {
+            calls->nQueued++;
+            lock.unlock();
+            bool fQueued = queueWork(boost::bind(&CRPCParallelCalls::Work, calls, true));
+            lock.lock();
+            if (!fQueued) {
+                calls->nQueued--;
+                break;
+            }
+        }
+    }
+
+    /** Run calls until none are left to start */
+    void Work(bool fHelper)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fHelper)
+            nQueued--;
+        if (fHelper && nActive >= nMaxActive)
+            return;
+        nActive++;
+        while (nNext < nEnd) {
+            size_t i = nNext++;
+            lock.unlock();
+            // Each call has its own result, the lock makes it visible to the others
+            vResults[i] = JSONRPCExecOne(vReq[i]);
+            lock.lock();
+        }
+        nActive--;
+        cond.notify_all();
+    }
+
+    /** Wait for the calls that were started to finish */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nActive > 0)
+            cond.wait(lock);
+    }
+};
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCQueueWorkFn& queueWork)
+{
+    int nParallel = queueWork ? GetArg("-rpcbatchparallel", DEFAULT_RPC_BATCH_PARALLEL) : 1;
+    std::vector<UniValue> vResults(vReq.size());
+    boost::shared_ptr<CRPCParallelCalls> calls;
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t reqEnd = reqIdx;
+        while (nParallel > 1 && reqEnd < vReq.size() && JSONRPCCanRunInParallel(vReq[reqEnd]))
+            reqEnd++;
+        if (reqEnd - reqIdx < 2) {
+            // Calls that change state run in order, with nothing alongside
+            vResults[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
+
+        if (!calls)
+            calls.reset(new CRPCParallelCalls(vReq, vResults, nParallel));
+        calls->Start(reqIdx, reqEnd);
+        // Helpers of an earlier stretch that did not start yet count against
+        // this one, so a batch never has more than nParallel - 1 of them in
+        // the work queue
+        size_t nHelpers = std::min((size_t)nParallel - 1, (reqEnd - reqIdx) / RPC_BATCH_CALLS_PER_HELPER);
+        CRPCParallelCalls::QueueHelpers(calls, nHelpers, queueWork);
+        calls->Work(false);
+        calls->Wait();
+        reqIdx = reqEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (unsigned int i = 0; i < vResults.size(); i++)
+        ret.push_back(vResults[i]);
 
     return ret.write() + "\n";
 }
@@ -447,6 +574,41 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, CJSONWriter& writer) const
+{
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (!pcmd || !pcmd->streamActor)
+        return false;
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    bool fWritten;
+    try
+    {
+        fWritten = pcmd->streamActor(params, writer);
+    }
+    catch (const std::exception& e)
+    {
+        g_rpcSignals.PostCommand(*pcmd);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    catch (...)
+    {
+        g_rpcSignals.PostCommand(*pcmd);
+        throw;
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+    return fWritten;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
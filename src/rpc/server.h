@@ -20,6 +20,8 @@
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Number of calls of a JSON-RPC batch that may run at the same time */
+static const int DEFAULT_RPC_BATCH_PARALLEL = 4;
 
 class CRPCCommand;
 
@@ -32,6 +34,7 @@ namespace RPCServer
 }
 
 class CBlockIndex;
+class CJSONWriter;
 class CNetAddr;
 
 /** Wrapper for UniValue::VType, which includes typeAny:
@@ -125,6 +128,8 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
+/** Writes the result of a call to writer itself, see CRPCTable::executeStream */
+typedef bool(*rpcstreamfn_type)(const UniValue& params, CJSONWriter& writer);
 
 class CRPCCommand
 {
@@ -133,6 +138,10 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Only reads state, so it may run alongside the calls around it in a batch
+    bool okParallel;
+    //! Optional, for results too large to build in memory at once
+    rpcstreamfn_type streamActor;
 };
 
 /**
@@ -156,6 +165,16 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method, writing its result to writer as it is produced.
+     * Methods without a streamActor, and those that leave the given params to
+     * the regular actor, return false without writing anything; use execute().
+     * @throws an exception (UniValue) when an error happens. That can be after
+     * part of the result was handed to the writer's sink, which then has to
+     * cut the reply off; the HTTP server does so in JSONErrorReply.
+     */
+    bool executeStream(const std::string &method, const UniValue &params, CJSONWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -191,11 +210,17 @@ extern std::string HelpExampleCli(const std::string& methodname, const std::stri
 extern std::string HelpExampleRpc(const std::string& methodname, const std::string& args);
 
 extern void EnsureWalletIsUnlocked();
+/** Drop the getblocktemplate template, once no RPC call can run anymore */
+extern void StopBlockTemplateUpdater();
 
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+/** Run a function on another thread, false if that cannot be done right now */
+typedef boost::function<bool (const boost::function<void ()>&)> RPCQueueWorkFn;
+/** Execute a batch of requests. Runs of okParallel calls are spread over
+ *  up to -rpcbatchparallel threads with queueWork, if given. */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCQueueWorkFn& queueWork = RPCQueueWorkFn());
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
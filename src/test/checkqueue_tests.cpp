@@ -0,0 +1,138 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+/** Counts how often it ran, fails if asked to */
+struct CCountingCheck
+{
+    std::atomic<unsigned int>* pnRun;
+    bool fOk;
+
+    CCountingCheck() : pnRun(NULL), fOk(true) {}
+    CCountingCheck(std::atomic<unsigned int>* pnRunIn, bool fOkIn) : pnRun(pnRunIn), fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        (*pnRun)++;
+        return fOk;
+    }
+
+    void swap(CCountingCheck& x)
+    {
+        std::swap(pnRun, x.pnRun);
+        std::swap(fOk, x.fOk);
+    }
+};
+
+/** A check queue with a number of worker threads */
+struct CCheckQueueSetup
+{
+    CCheckQueue<CCountingCheck> queue;
+    boost::thread_group threadGroup;
+
+    CCheckQueueSetup(int nThreads) : queue(16)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, boost::ref(queue)));
+    }
+
+    ~CCheckQueueSetup()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run)
+{
+    CCheckQueueSetup setup(3);
+    seed_insecure_rand(true);
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        std::atomic<unsigned int> nRun(0);
+        unsigned int nTotal = 0;
+        {
+            CCheckQueueControl<CCountingCheck> control(&setup.queue);
+            // Batches of the sizes blocks produce: mostly one or two inputs
+            for (int i = 0; i < 200; i++) {
+                std::vector<CCountingCheck> vChecks(1 + insecure_rand() % (i % 10 == 0 ? 50 : 3), CCountingCheck(&nRun, true));
+                nTotal += vChecks.size();
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nRun.load(), nTotal);
+        BOOST_CHECK(setup.queue.IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckQueueSetup setup(3);
+
+    for (int nRound = 0; nRound < 10; nRound++) {
+        std::atomic<unsigned int> nRun(0);
+        CCheckQueueControl<CCountingCheck> control(&setup.queue);
+        for (int i = 0; i < 100; i++) {
+            std::vector<CCountingCheck> vChecks(10, CCountingCheck(&nRun, true));
+            if (i == 50)
+                vChecks[5].fOk = false;
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(!control.Wait());
+        BOOST_CHECK(setup.queue.IsIdle());
+    }
+
+    // The queue can be reused after a failure
+    std::atomic<unsigned int> nRun(0);
+    CCheckQueueControl<CCountingCheck> control(&setup.queue);
+    std::vector<CCountingCheck> vChecks(100, CCountingCheck(&nRun, true));
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+    BOOST_CHECK_EQUAL(nRun.load(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure_skips_rest)
+{
+    // Without worker threads the master runs every check, most recently
+    // queued first, so the failing check comes up before all the others
+    CCheckQueueSetup setup(0);
+    std::atomic<unsigned int> nRun(0);
+    CCheckQueueControl<CCountingCheck> control(&setup.queue);
+    std::vector<CCountingCheck> vChecks(100, CCountingCheck(&nRun, true));
+    vChecks.back().fOk = false;
+    control.Add(vChecks);
+    BOOST_CHECK(!control.Wait());
+    BOOST_CHECK_EQUAL(nRun.load(), 1);
+    BOOST_CHECK(setup.queue.IsIdle());
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    // Without worker threads the master does all the work in Wait()
+    CCheckQueue<CCountingCheck> queue(16);
+    std::atomic<unsigned int> nRun(0);
+    CCheckQueueControl<CCountingCheck> control(&queue);
+    std::vector<CCountingCheck> vChecks(500, CCountingCheck(&nRun, true));
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+    BOOST_CHECK_EQUAL(nRun.load(), 500);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include "test/test_bitcoin.h"
 #include "main.h"
 #include "consensus/validation.h"
+#include "txdb.h"
 
 #include <vector>
 #include <map>
@@ -21,27 +22,27 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -51,8 +52,8 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
@@ -75,13 +76,22 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
 };
 
+/** Gives access to the database of a CCoinsViewDB to write legacy records */
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 23, true) {}
+
+    CDBWrapper& GetDB() { return db; }
+};
+
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -91,7 +101,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -103,13 +113,14 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -127,36 +138,59 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            COutPoint outpoint(txid, 0);
+            Coin& coin = result[outpoint];
+
+            // HaveCoin and AccessCoin can pull entries into the cache, so
+            // test HaveCoin before, after or around the access.
+            bool test_havecoin_before = insecure_rand() % 4 == 0;
+            bool test_havecoin_after = insecure_rand() % 4 == 0;
+
+            bool result_havecoin = test_havecoin_before ? stack.back()->HaveCoin(outpoint) : false;
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(outpoint);
+            BOOST_CHECK(coin == entry);
+            BOOST_CHECK(!test_havecoin_before || result_havecoin == !entry.IsSpent());
+
+            if (test_havecoin_after) {
+                bool ret = stack.back()->HaveCoin(outpoint);
+                BOOST_CHECK(ret == !entry.IsSpent());
+            }
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    // Unspendable outputs are never added to the cache
+                    newcoin.out.scriptPubKey.assign(1 + insecure_rand() % 64, OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    // Random sizes so we can test memory usage accounting
+                    newcoin.out.scriptPubKey.assign(insecure_rand() % 64, 0);
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(outpoint, std::move(newcoin), !coin.IsSpent() || insecure_rand() % 2);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(outpoint);
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -205,6 +239,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
@@ -220,7 +255,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     bool spent_a_duplicate_coinbase = false;
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -238,7 +273,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             tx.vin.resize(1);
             tx.vout.resize(1);
             tx.vout[0].nValue = i; //Keep txs unique unless intended to duplicate
-            unsigned int height = insecure_rand();
+            unsigned int height = insecure_rand() % 0x7FFFFFFF;
 
             // 1/10 times create a coinbase
             if (insecure_rand() % 10 == 0 || coinbaseids.size() < 10) {
@@ -273,8 +308,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[COutPoint(prevouthash, 0)].Clear();
 
                 // It is of particular importance here that once we spend a coinbase tx hash
                 // it is no longer available to be duplicated (or spent again)
@@ -294,21 +328,18 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            result[COutPoint(tx.GetHash(), 0)] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             UpdateCoins(tx, *(stack.back()), height);
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -346,56 +377,77 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_add_fetched)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    COutPoint outpoint(GetRandHash(), 1);
+    COutPoint outpointDirty(GetRandHash(), 0);
+
+    Coin coin;
+    coin.out.nValue = 100;
+    coin.nHeight = 10;
+    cache.AddCoin(outpointDirty, Coin(coin), false);
+    cache.SetBestBlock(GetRandHash());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(cache.GetCoinFromBase(outpointDirty, coin));
+    BOOST_CHECK(!cache.GetCoinFromBase(outpoint, coin));
+
+    // A fetched coin is cached, but not written back
+    cache.AddFetchedCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(cache.AccessCoin(outpoint) == coin);
+    cache.SelfTest();
+
+    // It does not replace a newer entry
+    cache.SpendCoin(outpointDirty);
+    cache.AddFetchedCoin(outpointDirty, Coin(coin));
+    BOOST_CHECK(!cache.HaveCoin(outpointDirty));
+    cache.SelfTest();
+
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.GetCoin(outpoint, coin));
+    BOOST_CHECK(!base.GetCoin(outpointDirty, coin) || coin.IsSpent());
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
-    // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
+    // Round trip
+    CDataStream ss2out(SER_DISK, CLIENT_VERSION);
+    ss2out << cc2;
+    BOOST_CHECK_EQUAL(HexStr(ss2out.begin(), ss2out.end()), "8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4");
 
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    // Smallest possible example
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -406,13 +458,109 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_upgrade, TestingSetup)
+{
+    // A per-transaction record as written by earlier versions: a coinbase at
+    // height 120891 with 17 outputs, of which only 4 and 16 are unspent
+    uint256 txid = GetRandHash();
+    std::vector<unsigned char> vchLegacy = ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b");
+    uint256 hashBlock = GetRandHash();
+
+    CCoinsViewDBTest view;
+    view.GetDB().Write(std::make_pair('c', txid), CFlatData(vchLegacy));
+    view.GetDB().Write('B', hashBlock);
+
+    BOOST_CHECK(!view.HaveCoin(COutPoint(txid, 4)));
+    BOOST_CHECK(view.Upgrade());
+    BOOST_CHECK(!view.GetDB().Exists(std::make_pair('c', txid)));
+    BOOST_CHECK(view.GetBestBlock() == hashBlock);
+
+    Coin coin;
+    BOOST_CHECK(view.GetCoin(COutPoint(txid, 4), coin));
+    BOOST_CHECK_EQUAL(coin.fCoinBase, true);
+    BOOST_CHECK_EQUAL(coin.nHeight, 120891);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 234925952);
+    BOOST_CHECK_EQUAL(HexStr(coin.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
+
+    BOOST_CHECK(view.GetCoin(COutPoint(txid, 16), coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(coin.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+
+    for (uint32_t n = 0; n < 17; n++) {
+        if (n != 4 && n != 16)
+            BOOST_CHECK(!view.HaveCoin(COutPoint(txid, n)));
+    }
+
+    // Nothing is left to convert
+    BOOST_CHECK(view.Upgrade());
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_flusher)
+{
+    CCoinsViewDB db(1 << 23, true);
+    COutPoint outpoint1(GetRandHash(), 0);
+    COutPoint outpoint2(GetRandHash(), 3);
+    uint256 hashBlock1 = GetRandHash();
+    uint256 hashBlock2 = GetRandHash();
+    uint256 hashBlock3 = GetRandHash();
+    Coin coin;
+    coin.out.nValue = 100;
+    coin.nHeight = 10;
+
+    {
+        CCoinsViewFlusher flusher(&db);
+        CCoinsViewCache cache(&flusher);
+        cache.AddCoin(outpoint1, Coin(coin), false);
+        cache.AddCoin(outpoint2, Coin(coin), false);
+        cache.SetBestBlock(hashBlock1);
+        BOOST_CHECK(cache.Flush());
+
+        // Visible right away, written or not
+        BOOST_CHECK(flusher.HaveCoin(outpoint1));
+        BOOST_CHECK(flusher.GetBestBlock() == hashBlock1);
+        BOOST_CHECK(flusher.Sync());
+        BOOST_CHECK(db.HaveCoin(outpoint1));
+        BOOST_CHECK(db.HaveCoin(outpoint2));
+        BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+
+        // A spend in the write in progress hides the coin in the database
+        BOOST_CHECK(cache.SpendCoin(outpoint1));
+        cache.SetBestBlock(hashBlock2);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!flusher.HaveCoin(outpoint1));
+        BOOST_CHECK(!flusher.GetCoin(outpoint1, coin));
+        BOOST_CHECK(flusher.GetCoin(outpoint2, coin));
+        BOOST_CHECK(flusher.GetBestBlock() == hashBlock2);
+        BOOST_CHECK(flusher.Sync());
+        BOOST_CHECK(!db.HaveCoin(outpoint1));
+        BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+
+        CCoinsFlushStats stats = flusher.GetStats();
+        BOOST_CHECK_EQUAL(stats.nFlushes, 2);
+        BOOST_CHECK_EQUAL(stats.nLastCoins, 1);
+        BOOST_CHECK_EQUAL(stats.nPendingCoins, 0);
+        BOOST_CHECK_EQUAL(stats.nPendingUsage, 0);
+        BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0);
+        BOOST_CHECK(!flusher.HasFailed());
+        BOOST_CHECK(stats.nLastBytes > 0);
+        BOOST_CHECK(stats.nTotalBytes > stats.nLastBytes);
+
+        // Destruction finishes the write in progress
+        BOOST_CHECK(cache.SpendCoin(outpoint2));
+        cache.SetBestBlock(hashBlock3);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoin(outpoint2));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
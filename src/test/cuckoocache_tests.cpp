@@ -0,0 +1,152 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> CTestCache;
+
+/** Deterministic set of distinct entries */
+static std::vector<uint256> MakeEntries(size_t n)
+{
+    seed_insecure_rand(true);
+    std::vector<uint256> entries(n);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < 8; j++)
+            WriteLE32(entries[i].begin() + 4 * j, insecure_rand());
+    }
+    return entries;
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty)
+{
+    CTestCache cache;
+    BOOST_CHECK_EQUAL(cache.setup_bytes(0), 2);
+    BOOST_CHECK_EQUAL(cache.setup_bytes(1 << 20), (1 << 20) / sizeof(uint256));
+
+    std::vector<uint256> entries = MakeEntries(1000);
+    for (size_t i = 0; i < entries.size(); i++)
+        BOOST_CHECK(!cache.contains(entries[i], false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    // Filling the table to 90% keeps nearly everything
+    CTestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+    std::vector<uint256> entries = MakeEntries(nSize * 9 / 10);
+    for (size_t i = 0; i < entries.size(); i++)
+        cache.insert(entries[i]);
+
+    size_t nHits = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+        nHits += cache.contains(entries[i], false);
+    BOOST_CHECK_GT(nHits, entries.size() * 95 / 100);
+
+    // Inserting again is a no-op
+    for (size_t i = 0; i < 100; i++) {
+        bool fHad = cache.contains(entries[i], false);
+        cache.insert(entries[i]);
+        BOOST_CHECK(!fHad || cache.contains(entries[i], false));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    // Erased entries stay visible until their slot is reused, and are the
+    // first to make room for new entries
+    CTestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+    std::vector<uint256> entries = MakeEntries(nSize);
+    size_t nHalf = nSize / 2;
+    for (size_t i = 0; i < nHalf; i++)
+        cache.insert(entries[i]);
+
+    for (size_t i = 0; i < nHalf; i += 2)
+        cache.contains(entries[i], true);
+
+    for (size_t i = nHalf; i < entries.size(); i++)
+        cache.insert(entries[i]);
+
+    size_t nKept = 0, nErasedKept = 0;
+    for (size_t i = 0; i < nHalf; i += 2) {
+        nErasedKept += cache.contains(entries[i], false);
+        nKept += cache.contains(entries[i + 1], false);
+    }
+    BOOST_CHECK_GT(nKept, nErasedKept);
+    BOOST_CHECK_GT(nKept, nHalf / 2 * 3 / 4);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    // Writing the table over several times prefers recent entries
+    CTestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+    std::vector<uint256> entries = MakeEntries(nSize * 4);
+    for (size_t i = 0; i < entries.size(); i++)
+        cache.insert(entries[i]);
+
+    size_t nOld = 0, nRecent = 0;
+    size_t nQuarter = nSize / 4;
+    for (size_t i = 0; i < nQuarter; i++) {
+        nOld += cache.contains(entries[i], false);
+        nRecent += cache.contains(entries[entries.size() - 1 - i], false);
+    }
+    BOOST_CHECK_LT(nOld, nQuarter / 100);
+    BOOST_CHECK_GT(nRecent, nQuarter * 95 / 100);
+}
+
+namespace
+{
+/** Look up entries until fStop, counting the ones found */
+void LookUpEntries(const CTestCache* cache, const std::vector<uint256>* entries, const std::atomic<bool>* fStop, size_t* pnHits)
+{
+    while (!*fStop) {
+        for (size_t i = 0; i < entries->size(); i++)
+            *pnHits += cache->contains((*entries)[i], i % 2 == 0);
+    }
+}
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent_contains)
+{
+    // Lookups take no lock. While a small table is written over, entries
+    // that were never inserted are never found
+    CTestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 14);
+    std::vector<uint256> entries = MakeEntries(nSize * 8);
+    std::vector<uint256> absent(entries.begin(), entries.begin() + nSize);
+
+    std::atomic<bool> fStop(false);
+    std::vector<size_t> vHits(4, 0);
+    boost::thread_group threads;
+    for (size_t i = 0; i < vHits.size(); i++)
+        threads.create_thread(boost::bind(&LookUpEntries, &cache, &absent, &fStop, &vHits[i]));
+    for (size_t i = nSize; i < entries.size(); i++)
+        cache.insert(entries[i]);
+    fStop = true;
+    threads.join_all();
+
+    for (size_t i = 0; i < vHits.size(); i++)
+        BOOST_CHECK_EQUAL(vHits[i], 0);
+    size_t nRecent = 0;
+    for (size_t i = entries.size() - nSize / 4; i < entries.size(); i++)
+        nRecent += cache.contains(entries[i], false);
+    BOOST_CHECK_GT(nRecent, nSize / 4 * 9 / 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexsnapshot.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <stdio.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(indexsnapshot_tests, BasicTestingSetup)
+
+/** Block index map owning its entries, filled by the snapshot loader */
+struct CTestBlockMap
+{
+    std::map<uint256, CBlockIndex*> map;
+
+    ~CTestBlockMap()
+    {
+        for (std::map<uint256, CBlockIndex*>::iterator it = map.begin(); it != map.end(); ++it)
+            delete it->second;
+    }
+
+    CBlockIndex* Insert(const uint256& hash)
+    {
+        if (hash.IsNull())
+            return NULL;
+        std::map<uint256, CBlockIndex*>::iterator it = map.find(hash);
+        if (it != map.end())
+            return it->second;
+        CBlockIndex* pindex = new CBlockIndex();
+        it = map.insert(std::make_pair(hash, pindex)).first;
+        pindex->phashBlock = &it->first;
+        return pindex;
+    }
+};
+
+/** A chain of 100 blocks plus a short fork, in no particular order */
+static void CreateIndex(CTestBlockMap& blocks, std::vector<CBlockIndex*>& vIndex)
+{
+    CBlockIndex* pprev = NULL;
+    CBlockIndex* pfork = NULL;
+    for (int i = 0; i < 110; i++) {
+        uint256 hash = ArithToUint256(arith_uint256(i + 1));
+        CBlockIndex* pindex = blocks.Insert(hash);
+        pindex->pprev = i < 100 ? pprev : (i == 100 ? blocks.map[ArithToUint256(arith_uint256(90))] : pfork);
+        pindex->nHeight = pindex->pprev ? pindex->pprev->nHeight + 1 : 0;
+        pindex->nTime = 1400000000 + i * 120;
+        pindex->nBits = 0x1e0ffff0;
+        pindex->nNonce = i;
+        pindex->nTx = 1;
+        pindex->nFile = 0;
+        pindex->nDataPos = 8 + i * 1000;
+        pindex->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA;
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (i < 100)
+            pprev = pindex;
+        else
+            pfork = pindex;
+        vIndex.insert(vIndex.begin() + (i * 7) % (vIndex.size() + 1), pindex);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(indexsnapshot_roundtrip)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / strprintf("test_egulden_snapshot_%i", (int)GetRand(100000));
+    uint256 hashBest = ArithToUint256(arith_uint256(100));
+
+    CTestBlockMap blocks;
+    std::vector<CBlockIndex*> vIndex;
+    CreateIndex(blocks, vIndex);
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, hashBest, vIndex));
+
+    CTestBlockMap loaded;
+    std::vector<CBlockIndex*> vSorted;
+    BOOST_CHECK(LoadBlockIndexSnapshot(path, hashBest, boost::bind(&CTestBlockMap::Insert, &loaded, _1), vSorted));
+    BOOST_CHECK_EQUAL(vSorted.size(), vIndex.size());
+    BOOST_CHECK_EQUAL(loaded.map.size(), blocks.map.size());
+
+    for (unsigned int i = 0; i < vSorted.size(); i++) {
+        const CBlockIndex* pindex = vSorted[i];
+        const CBlockIndex* pexpected = blocks.map[pindex->GetBlockHash()];
+        if (i > 0)
+            BOOST_CHECK(vSorted[i - 1]->nHeight <= pindex->nHeight);
+        BOOST_CHECK_EQUAL(pindex->nHeight, pexpected->nHeight);
+        BOOST_CHECK(pindex->nChainWork == pexpected->nChainWork);
+        BOOST_CHECK_EQUAL(pindex->nTime, pexpected->nTime);
+        BOOST_CHECK_EQUAL(pindex->nNonce, pexpected->nNonce);
+        BOOST_CHECK_EQUAL(pindex->nDataPos, pexpected->nDataPos);
+        BOOST_CHECK_EQUAL(pindex->nStatus, pexpected->nStatus);
+        BOOST_CHECK_EQUAL(pindex->pprev ? pindex->pprev->GetBlockHash().ToString() : "",
+                          pexpected->pprev ? pexpected->pprev->GetBlockHash().ToString() : "");
+    }
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(indexsnapshot_rejected)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / strprintf("test_egulden_snapshot_%i", (int)GetRand(100000));
+    uint256 hashBest = ArithToUint256(arith_uint256(100));
+
+    CTestBlockMap blocks;
+    std::vector<CBlockIndex*> vIndex;
+    CreateIndex(blocks, vIndex);
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, hashBest, vIndex));
+
+    // Written at a different best block
+    {
+        CTestBlockMap loaded;
+        std::vector<CBlockIndex*> vSorted;
+        BOOST_CHECK(!LoadBlockIndexSnapshot(path, ArithToUint256(arith_uint256(99)), boost::bind(&CTestBlockMap::Insert, &loaded, _1), vSorted));
+        BOOST_CHECK(loaded.map.empty());
+    }
+
+    // A flipped bit fails the checksum before anything is loaded
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_CHECK(file != NULL);
+    fseek(file, 200, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, 200, SEEK_SET);
+    fputc(ch ^ 1, file);
+    fclose(file);
+    {
+        CTestBlockMap loaded;
+        std::vector<CBlockIndex*> vSorted;
+        BOOST_CHECK(!LoadBlockIndexSnapshot(path, hashBest, boost::bind(&CTestBlockMap::Insert, &loaded, _1), vSorted));
+        BOOST_CHECK(loaded.map.empty());
+    }
+
+    // Missing file
+    boost::filesystem::remove(path);
+    {
+        CTestBlockMap loaded;
+        std::vector<CBlockIndex*> vSorted;
+        BOOST_CHECK(!LoadBlockIndexSnapshot(path, hashBest, boost::bind(&CTestBlockMap::Insert, &loaded, _1), vSorted));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonwriter.h"
+#include "test/test_bitcoin.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+namespace
+{
+bool CollectChunk(std::vector<std::string>& vChunks, size_t nMaxChunks, const std::string& strChunk)
+{
+    vChunks.push_back(strChunk);
+    return vChunks.size() < nMaxChunks;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsonwriter_document)
+{
+    UniValue entry(UniValue::VOBJ);
+    entry.push_back(Pair("size", 225));
+    entry.push_back(Pair("depends", UniValue(UniValue::VARR)));
+
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("hash", "00ff"));
+    UniValue txs(UniValue::VARR);
+    txs.push_back(entry);
+    txs.push_back("a \"quoted\"\nstring");
+    txs.push_back(UniValue(UniValue::VARR));
+    expected.push_back(Pair("tx", txs));
+    expected.push_back(Pair("key\twith\\escapes", NullUniValue));
+
+    std::vector<std::string> vChunks;
+    CJSONWriter writer(boost::bind(CollectChunk, boost::ref(vChunks), 100, _1));
+    writer.BeginObject();
+    writer.Write("hash", "00ff");
+    writer.Key("tx");
+    writer.BeginArray();
+    writer.Write(entry);
+    writer.Write("a \"quoted\"\nstring");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.EndArray();
+    writer.Write("key\twith\\escapes", NullUniValue);
+    writer.EndObject();
+
+    // Nothing is handed over before a chunk is full
+    BOOST_CHECK(writer.MaybeFlush());
+    BOOST_CHECK(vChunks.empty());
+    BOOST_CHECK_EQUAL(writer.GetPending(), expected.write());
+    BOOST_CHECK(writer.Flush());
+    BOOST_REQUIRE_EQUAL(vChunks.size(), 1U);
+    BOOST_CHECK_EQUAL(vChunks[0], expected.write());
+    BOOST_CHECK(writer.GetPending().empty());
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_chunks)
+{
+    UniValue expected(UniValue::VARR);
+    std::vector<std::string> vChunks;
+    CJSONWriter writer(boost::bind(CollectChunk, boost::ref(vChunks), 100, _1), 16);
+    writer.BeginArray();
+    for (int i = 0; i < 50; i++) {
+        expected.push_back(i);
+        writer.Write(i);
+        BOOST_CHECK(writer.MaybeFlush());
+    }
+    writer.EndArray();
+    writer.WriteRaw("\n");
+    BOOST_CHECK(writer.Flush());
+
+    std::string strAll;
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        if (i + 1 < vChunks.size())
+            BOOST_CHECK(vChunks[i].size() >= 16 && vChunks[i].size() < 20);
+        strAll += vChunks[i];
+    }
+    BOOST_CHECK_EQUAL(strAll, expected.write() + "\n");
+
+    // Once the sink gives up everything else is dropped
+    vChunks.clear();
+    CJSONWriter writerStopped(boost::bind(CollectChunk, boost::ref(vChunks), 2, _1), 16);
+    writerStopped.BeginArray();
+    for (int i = 0; i < 50; i++) {
+        writerStopped.Write(i);
+        if (!writerStopped.MaybeFlush())
+            break;
+    }
+    BOOST_CHECK(!writerStopped.Good());
+    BOOST_CHECK(!writerStopped.Flush());
+    BOOST_CHECK_EQUAL(vChunks.size(), 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
 #include "main.h"
+#include "pow.h"
+#include "streams.h"
+#include "versionbits.h"
 
 #include "test/test_bitcoin.h"
 
@@ -76,4 +81,122 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindex = chainActive.Genesis();
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+
+    // The raw bytes are what PushMessage(NetMsgType::BLOCK, block) sends
+    std::vector<unsigned char> vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), chainparams.MessageStart()));
+    BOOST_CHECK(vchBlock == std::vector<unsigned char>(ss.begin(), ss.end()));
+
+    // Blocks of another network are not served
+    CMessageHeader::MessageStartChars messageStart;
+    memcpy(messageStart, chainparams.MessageStart(), MESSAGE_START_SIZE);
+    messageStart[0] ^= 0xff;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), messageStart));
+
+    // Nor is anything that does not start at a block
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pos, chainparams.MessageStart()));
+}
+
+namespace
+{
+struct RegTestingSetup : public TestingSetup {
+    RegTestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+/** A coinbase-only regtest block on top of hashPrev, not processed */
+CBlock CreateTestBlock(const uint256& hashPrev, int nHeight)
+{
+    const CChainParams& chainparams = Params();
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 0;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CBlock block;
+    block.nVersion = VERSIONBITS_TOP_BITS;
+    block.hashPrevBlock = hashPrev;
+    block.nTime = chainparams.GenesisBlock().nTime + nHeight * chainparams.GetConsensus().nPowTargetSpacing;
+    block.nBits = chainparams.GenesisBlock().nBits;
+    block.vtx.push_back(coinbase);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, chainparams.GetConsensus()))
+        ++block.nNonce;
+    return block;
+}
+
+/** A block as stored in a blk?????.dat file, with its message start and size */
+std::vector<char> BlockRecord(const CBlock& block)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << FLATDATA(Params().MessageStart()) << (unsigned int)GetSerializeSize(block, SER_DISK, CLIENT_VERSION) << block;
+    return std::vector<char>(ss.begin(), ss.end());
+}
+}
+
+BOOST_FIXTURE_TEST_CASE(load_external_block_file, RegTestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    std::vector<CBlock> vBlocks;
+    uint256 hashPrev = chainActive.Tip()->GetBlockHash();
+    for (int i = 1; i <= 5; i++) {
+        vBlocks.push_back(CreateTestBlock(hashPrev, i));
+        hashPrev = vBlocks.back().GetHash();
+    }
+    std::vector<char> vchRecord2 = BlockRecord(vBlocks[1]);
+    std::vector<char> vchRecord5 = BlockRecord(vBlocks[4]);
+
+    // Block 1; a record that does not deserialize (the transaction count
+    // is out of range) and that claims block 2, which only the resync from
+    // just after its message start finds; block 4 before its parent; and
+    // block 5 cut off halfway.
+    std::vector<char> vchFile = BlockRecord(vBlocks[0]);
+    CDataStream ssCorrupt(SER_DISK, CLIENT_VERSION);
+    ssCorrupt << FLATDATA(chainparams.MessageStart()) << (unsigned int)(80 + 9 + vchRecord2.size());
+    vchFile.insert(vchFile.end(), ssCorrupt.begin(), ssCorrupt.end());
+    vchFile.insert(vchFile.end(), 80 + 9, (char)0xff);
+    size_t nPos2 = vchFile.size() + MESSAGE_START_SIZE + sizeof(unsigned int);
+    vchFile.insert(vchFile.end(), vchRecord2.begin(), vchRecord2.end());
+    std::vector<char> vchRecord4 = BlockRecord(vBlocks[3]);
+    vchFile.insert(vchFile.end(), vchRecord4.begin(), vchRecord4.end());
+    std::vector<char> vchRecord3 = BlockRecord(vBlocks[2]);
+    vchFile.insert(vchFile.end(), vchRecord3.begin(), vchRecord3.end());
+    vchFile.insert(vchFile.end(), vchRecord5.begin(), vchRecord5.begin() + vchRecord5.size() / 2);
+
+    // Import it the way -reindex does, from a block file of the node
+    CDiskBlockPos pos(1, 0);
+    FILE* file = OpenBlockFile(pos);
+    BOOST_REQUIRE(file != NULL);
+    BOOST_REQUIRE_EQUAL(fwrite(&vchFile[0], 1, vchFile.size(), file), vchFile.size());
+    fclose(file);
+    file = OpenBlockFile(pos, true);
+    BOOST_REQUIRE(file != NULL);
+    BOOST_CHECK(LoadExternalBlockFile(chainparams, file, &pos));
+
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, chainparams));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 4);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks[3].GetHash());
+    for (int i = 0; i < 4; i++) {
+        BlockMap::iterator mi = mapBlockIndex.find(vBlocks[i].GetHash());
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        BOOST_CHECK(chainActive.Contains(mi->second));
+        BOOST_CHECK_EQUAL(mi->second->nFile, 1);
+    }
+    BOOST_CHECK_EQUAL(mapBlockIndex[vBlocks[1].GetHash()]->nDataPos, nPos2);
+    BOOST_CHECK(mapBlockIndex.count(vBlocks[4].GetHash()) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
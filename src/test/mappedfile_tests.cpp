@@ -0,0 +1,77 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+void AppendToFile(const boost::filesystem::path& path, const std::string& str)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_REQUIRE_EQUAL(fwrite(str.data(), 1, str.size(), file), str.size());
+    fclose(file);
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(mappedfile_tests, BasicTestingSetup)
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(mappedfile_cache)
+{
+    boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir);
+    boost::filesystem::path pathA = dir / "a.dat", pathB = dir / "b.dat", pathC = dir / "c.dat";
+    AppendToFile(pathA, "aaaa");
+    AppendToFile(pathB, "bbbb");
+    AppendToFile(pathC, "cccc");
+
+    CMappedFileCache cache(2);
+    std::shared_ptr<const CMappedFile> mapping = cache.Get(pathA, 4);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(std::string(mapping->data(), mapping->size()), "aaaa");
+    BOOST_CHECK(cache.Get(dir / "missing.dat", 0) == NULL);
+
+    // Mappings are reused until they are the least recently used of too many
+    BOOST_CHECK(cache.Get(pathB, 4));
+    BOOST_CHECK(cache.Get(pathA, 4) == mapping);
+    BOOST_CHECK(cache.Get(pathC, 4));
+    BOOST_CHECK_EQUAL(cache.GetMappedFiles(), 2U);
+    BOOST_CHECK(cache.Get(pathA, 4) == mapping);
+    uint64_t nHits, nMisses;
+    cache.GetStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 2U);
+    BOOST_CHECK_EQUAL(nMisses, 4U);
+
+    // A file that grew is mapped again when more of it is asked for
+    AppendToFile(pathA, "AAAA");
+    BOOST_CHECK(cache.Get(pathA, 4) == mapping);
+    std::shared_ptr<const CMappedFile> mappingGrown = cache.Get(pathA, 8);
+    BOOST_REQUIRE(mappingGrown);
+    BOOST_CHECK_EQUAL(std::string(mappingGrown->data(), mappingGrown->size()), "aaaaAAAA");
+    BOOST_CHECK(cache.Get(pathA, 9) == NULL);
+
+    // Dropped mappings stay readable for whoever still holds them, also after the file is gone
+    cache.Erase(pathA);
+    boost::filesystem::remove(pathA);
+    BOOST_CHECK_EQUAL(cache.GetMappedFiles(), 1U);
+    BOOST_CHECK_EQUAL(std::string(mapping->data(), mapping->size()), "aaaa");
+    BOOST_CHECK(cache.Get(pathA, 0) == NULL);
+
+    cache.SetMaxFiles(0);
+    BOOST_CHECK_EQUAL(cache.GetMappedFiles(), 0U);
+    BOOST_CHECK(cache.Get(pathB, 4) == NULL);
+
+    boost::filesystem::remove_all(dir);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -578,4 +578,39 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolScriptsCheckedTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    CTransaction txChecked(tx);
+    BOOST_CHECK(!pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_NONE));
+
+    // Unknown flags are no flags
+    pool.addUnchecked(txChecked.GetHash(), entry.FromTx(tx));
+    BOOST_CHECK(pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_NONE));
+    BOOST_CHECK(!pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_P2SH));
+    pool.clear();
+
+    CTxMemPoolEntry entryChecked = entry.FromTx(tx);
+    entryChecked.SetScriptFlags(SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS);
+    pool.addUnchecked(txChecked.GetHash(), entryChecked);
+    BOOST_CHECK(pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_P2SH));
+    BOOST_CHECK(pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS));
+    BOOST_CHECK(!pool.ScriptsChecked(txChecked, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY));
+
+    // The same txid with another witness was not checked
+    tx.wit.vtxinwit.resize(1);
+    tx.wit.vtxinwit[0].scriptWitness.stack.push_back(std::vector<unsigned char>(1, 1));
+    CTransaction txOtherWitness(tx);
+    BOOST_CHECK(txOtherWitness.GetHash() == txChecked.GetHash());
+    BOOST_CHECK(!pool.ScriptsChecked(txOtherWitness, SCRIPT_VERIFY_P2SH));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -502,4 +502,87 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(BlockTemplateUpdater_incremental)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    TestMemPoolEntryHelper entry;
+    const CAmount BLOCKSUBSIDY = 50*COIN;
+    const CAmount HIGHFEE = COIN;
+    LOCK(cs_main);
+    // Keep the template from being assembled anew while the updates are checked
+    SetMockTime(GetTime());
+
+    // Spendable outputs to build the mempool transactions on
+    std::vector<CMutableTransaction> vtx(4);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        COutPoint prevout(GetRandHash(), 0);
+        pcoinsTip->AddCoin(prevout, Coin(CTxOut(BLOCKSUBSIDY, CScript() << OP_TRUE), 0, false), false);
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].prevout = prevout;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].nValue = BLOCKSUBSIDY;
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_TRUE;
+    }
+    // A child of the first
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(vtx[0].GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].nValue = BLOCKSUBSIDY;
+    txChild.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    // The first block's subsidy is all there is to be had, so the fees are
+    // only given by prioritisation. The last transaction pays none.
+    mempool.PrioritiseTransaction(vtx[0].GetHash(), vtx[0].GetHash().ToString(), 0.0, HIGHFEE);
+    mempool.PrioritiseTransaction(vtx[1].GetHash(), vtx[1].GetHash().ToString(), 0.0, HIGHFEE);
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0.0, HIGHFEE);
+
+    CBlockTemplateUpdater updater(chainparams, CScript() << OP_TRUE);
+    CBlockTemplate* pblocktemplate = updater.Get();
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK(updater.Get() == pblocktemplate);
+
+    mempool.addUnchecked(vtx[0].GetHash(), entry.Fee(0).FromTx(vtx[0]));
+    mempool.addUnchecked(vtx[1].GetHash(), entry.Fee(0).FromTx(vtx[1]));
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(0).FromTx(txChild));
+    mempool.addUnchecked(vtx[3].GetHash(), entry.Fee(0).FromTx(vtx[3]));
+    BOOST_CHECK_EQUAL(updater.GetChanges(), 4U);
+    BOOST_CHECK_EQUAL(updater.GetChangesApplied(), 0U);
+
+    // The same template, with the new transactions that pay enough
+    BOOST_CHECK(updater.Get() == pblocktemplate);
+    BOOST_CHECK_EQUAL(updater.GetChangesApplied(), 4U);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 4U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == vtx[0].GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == vtx[1].GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == txChild.GetHash());
+
+    // Taking out a transaction takes out what spends it
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(vtx[0], removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    BOOST_CHECK(updater.Get() == pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == vtx[1].GetHash());
+
+    // Prioritising a transaction gets it in
+    mempool.PrioritiseTransaction(vtx[3].GetHash(), vtx[3].GetHash().ToString(), 0.0, HIGHFEE);
+    BOOST_CHECK(updater.Get() == pblocktemplate);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == vtx[3].GetHash());
+
+    // Clearing the mempool takes them all out
+    uint64_t nChanges = updater.GetChanges();
+    mempool.clear();
+    BOOST_CHECK_EQUAL(updater.GetChanges(), nChanges + 2);
+    BOOST_CHECK(updater.Get() == pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+
+    mempool.ClearPrioritisation(vtx[0].GetHash());
+    mempool.ClearPrioritisation(vtx[1].GetHash());
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(vtx[3].GetHash());
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,309 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "main.h"
+#include "net.h"
+#include "netbase.h"
+#include "netpoll.h"
+#include "protocol.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/**
+ * The remote end of a loopback connection to an inbound CNode, speaking just
+ * enough of the protocol to do a handshake and ping.
+ */
+class CTestPeer
+{
+public:
+    SOCKET hSocket;
+    CNode* pnode;
+    std::vector<char> vRecvBuf;
+
+    CTestPeer(SOCKET hListen, const struct sockaddr_in& addrListen, unsigned short nPort)
+    {
+        hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+        BOOST_REQUIRE(connect(hSocket, (struct sockaddr*)&addrListen, sizeof(addrListen)) == 0);
+        struct timeval timeout = MillisToTimeval(10000);
+        setsockopt(hSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+        SOCKET hServer = accept(hListen, NULL, NULL);
+        BOOST_REQUIRE(hServer != INVALID_SOCKET);
+        BOOST_REQUIRE(SetSocketNonBlocking(hServer, true));
+        struct in_addr loopback;
+        loopback.s_addr = htonl(INADDR_LOOPBACK);
+        pnode = new CNode(hServer, CAddress(CService(loopback, nPort), NODE_NONE), "", true);
+        pnode->AddRef();
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    ~CTestPeer()
+    {
+        {
+            LOCK(cs_vNodes);
+            vNodes.erase(std::remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+        }
+        pnode->Release();
+        delete pnode;
+        CloseSocket(hSocket);
+    }
+
+    //! Send a message. Returns false on error.
+    bool Send(const std::string& strCommand, const CDataStream& payload)
+    {
+        std::string strPayload = payload.str();
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        CMessageHeader hdr(Params().MessageStart(), strCommand.c_str(), strPayload.size());
+        uint256 hash = Hash(strPayload.begin(), strPayload.end());
+        hdr.nChecksum = ReadLE32(hash.begin());
+        ss << hdr;
+        ss.write(strPayload.data(), strPayload.size());
+        return send(hSocket, &ss[0], ss.size(), MSG_NOSIGNAL) == (int)ss.size();
+    }
+
+    //! Read the next message. Returns false on timeout or error.
+    bool Receive(std::string& strCommand, CDataStream& payload)
+    {
+        while (true) {
+            if (vRecvBuf.size() >= CMessageHeader::HEADER_SIZE) {
+                CDataStream ssHeader(&vRecvBuf[0], &vRecvBuf[0] + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+                CMessageHeader hdr(Params().MessageStart());
+                ssHeader >> hdr;
+                if (vRecvBuf.size() >= CMessageHeader::HEADER_SIZE + hdr.nMessageSize) {
+                    strCommand = hdr.GetCommand();
+                    payload = CDataStream(&vRecvBuf[0] + CMessageHeader::HEADER_SIZE, &vRecvBuf[0] + CMessageHeader::HEADER_SIZE + hdr.nMessageSize, SER_NETWORK, PROTOCOL_VERSION);
+                    vRecvBuf.erase(vRecvBuf.begin(), vRecvBuf.begin() + CMessageHeader::HEADER_SIZE + hdr.nMessageSize);
+                    return true;
+                }
+            }
+            char pchBuf[0x1000];
+            int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), 0);
+            if (nBytes <= 0)
+                return false;
+            vRecvBuf.insert(vRecvBuf.end(), pchBuf, pchBuf + nBytes);
+        }
+    }
+
+    //! Read messages until one with the given command comes in
+    bool ReceiveUntil(const std::string& strWanted, CDataStream& payload)
+    {
+        std::string strCommand;
+        while (Receive(strCommand, payload)) {
+            if (strCommand == strWanted)
+                return true;
+        }
+        return false;
+    }
+
+    void Handshake()
+    {
+        CDataStream payload(SER_NETWORK, INIT_PROTO_VERSION);
+        CAddress addrNone;
+        payload << PROTOCOL_VERSION << (uint64_t)NODE_NONE << GetTime() << addrNone << addrNone << GetRand(std::numeric_limits<uint64_t>::max())
+                << FormatSubVersion(CLIENT_NAME, CLIENT_VERSION, std::vector<std::string>()) << 0 << false;
+        BOOST_REQUIRE(Send(NetMsgType::VERSION, payload));
+        CDataStream ssReply(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_REQUIRE(ReceiveUntil(NetMsgType::VERACK, ssReply));
+    }
+};
+
+/** Stands in for ThreadSocketHandler: moves received bytes into the nodes, and sends what they could not send right away */
+void ThreadTestSocketHandler(std::vector<CNode*> vNodesIn)
+{
+    boost::scoped_ptr<CSocketPoller> poller(CreateSocketPoller());
+    std::map<SOCKET, CNode*> mapNode;
+    BOOST_FOREACH(CNode* pnode, vNodesIn) {
+        poller->Add(pnode->hSocket);
+        mapNode[pnode->hSocket] = pnode;
+    }
+    std::set<CNode*> setReadable;
+    while (true) {
+        std::vector<std::pair<SOCKET, int> > vEvents;
+        poller->Wait(setReadable.empty() ? 10 : 1, vEvents);
+        boost::this_thread::interruption_point();
+        for (size_t i = 0; i < vEvents.size(); i++) {
+            if (vEvents[i].second & SOCKET_RECV)
+                setReadable.insert(mapNode[vEvents[i].first]);
+        }
+
+        std::set<CNode*> setReadableCopy = setReadable;
+        BOOST_FOREACH(CNode* pnode, setReadableCopy) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv)
+                continue;
+            char pchBuf[0x10000];
+            int nBytes;
+            while ((nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT)) > 0)
+                pnode->ReceiveMsgBytes(pchBuf, nBytes);
+            setReadable.erase(pnode);
+            poller->Rearm(pnode->hSocket, SOCKET_RECV);
+        }
+
+        BOOST_FOREACH(CNode* pnode, vNodesIn) {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend && !pnode->vSendMsg.empty())
+                SocketSendData(pnode);
+        }
+    }
+}
+
+/** Like a validation thread connecting blocks: holds cs_main most of the time */
+void ThreadBusyValidation()
+{
+    while (true) {
+        {
+            LOCK(cs_main);
+            MilliSleep(20);
+        }
+        MilliSleep(1);
+    }
+}
+
+/** Ping repeatedly and record the round trip times, in microseconds. Runs in its own thread, so no BOOST_CHECKs here. */
+void PingLoop(CTestPeer* ppeer, int nPings, std::vector<int64_t>* pvLatency, bool* pfOk)
+{
+    *pfOk = true;
+    for (int i = 0; i < nPings; i++) {
+        uint64_t nonce = GetRand(std::numeric_limits<uint64_t>::max());
+        CDataStream ssPing(SER_NETWORK, PROTOCOL_VERSION);
+        ssPing << nonce;
+        int64_t nStart = GetTimeMicros();
+        CDataStream ssPong(SER_NETWORK, PROTOCOL_VERSION);
+        uint64_t nonceReply = 0;
+        if (!ppeer->Send(NetMsgType::PING, ssPing) || !ppeer->ReceiveUntil(NetMsgType::PONG, ssPong)) {
+            *pfOk = false;
+            return;
+        }
+        ssPong >> nonceReply;
+        pvLatency->push_back(GetTimeMicros() - nStart);
+        // Pongs come back in order
+        if (nonceReply != nonce) {
+            *pfOk = false;
+            return;
+        }
+        MilliSleep(5);
+    }
+}
+
+/**
+ * Loopback peer harness: some peers ping while another one keeps sending
+ * getheaders, which needs cs_main, and cs_main is mostly held by validation.
+ * Returns the sorted ping round trip times.
+ */
+std::vector<int64_t> MeasurePingLatency(int nThreads, int nPingers, int nPings)
+{
+    SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hListen != INVALID_SOCKET);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&addr, len) == 0);
+    BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&addr, &len) == 0);
+    BOOST_REQUIRE(listen(hListen, SOMAXCONN) == 0);
+
+    std::vector<CTestPeer*> vPeers;
+    std::vector<CNode*> vPeerNodes;
+    for (int i = 0; i < nPingers + 1; i++) {
+        vPeers.push_back(new CTestPeer(hListen, addr, 10000 + i));
+        vPeerNodes.push_back(vPeers.back()->pnode);
+    }
+    CloseSocket(hListen);
+    CTestPeer* pbusy = vPeers.back();
+
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&ThreadTestSocketHandler, vPeerNodes));
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(&ThreadMessageHandler);
+    BOOST_FOREACH(CTestPeer* ppeer, vPeers)
+        ppeer->Handshake();
+
+    boost::thread_group threadValidation;
+    threadValidation.create_thread(&ThreadBusyValidation);
+    CDataStream ssGetHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    ssGetHeaders << CBlockLocator() << uint256();
+    for (int i = 0; i < 1000; i++)
+        BOOST_REQUIRE(pbusy->Send(NetMsgType::GETHEADERS, ssGetHeaders));
+
+    std::vector<std::vector<int64_t> > vvLatency(nPingers);
+    bool* pfOk = new bool[nPingers];
+    boost::thread_group threadPingers;
+    for (int i = 0; i < nPingers; i++)
+        threadPingers.create_thread(boost::bind(&PingLoop, vPeers[i], nPings, &vvLatency[i], &pfOk[i]));
+    threadPingers.join_all();
+
+    threadValidation.interrupt_all();
+    threadValidation.join_all();
+    // The getheaders are all handled too, once cs_main is free
+    bool fDrained = false;
+    for (int i = 0; i < 1000 && !fDrained; i++) {
+        {
+            LOCK(pbusy->pnode->cs_vRecvMsg);
+            fDrained = pbusy->pnode->vRecvMsg.empty();
+        }
+        if (!fDrained)
+            MilliSleep(10);
+    }
+    BOOST_CHECK(fDrained);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    std::vector<int64_t> vLatency;
+    for (int i = 0; i < nPingers; i++) {
+        BOOST_CHECK(pfOk[i]);
+        BOOST_CHECK_EQUAL(vvLatency[i].size(), (size_t)nPings);
+        vLatency.insert(vLatency.end(), vvLatency[i].begin(), vvLatency[i].end());
+    }
+    delete[] pfOk;
+    BOOST_FOREACH(CTestPeer* ppeer, vPeers)
+        delete ppeer;
+    std::sort(vLatency.begin(), vLatency.end());
+    return vLatency;
+}
+
+int64_t Percentile(const std::vector<int64_t>& vSorted, int nPercent)
+{
+    if (vSorted.empty())
+        return 0;
+    return vSorted[std::min(vSorted.size() - 1, vSorted.size() * nPercent / 100)];
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(msghand_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(msghand_ping_latency)
+{
+    // Every ping is answered, in order per peer (checked in PingLoop). The
+    // latencies are only reported: with one thread pings wait behind the
+    // getheaders that waits for cs_main, with more another thread answers
+    // them, but timings are too noisy on a loaded machine to assert on.
+    int vThreads[] = {1, 4};
+    BOOST_FOREACH(int nThreads, vThreads) {
+        std::vector<int64_t> vLatency = MeasurePingLatency(nThreads, 4, 50);
+        BOOST_CHECK_EQUAL(vLatency.size(), 4 * 50U);
+        BOOST_TEST_MESSAGE(strprintf("%d message handler threads: ping p50 %.2fms, p99 %.2fms", nThreads,
+            0.001 * Percentile(vLatency, 50), 0.001 * Percentile(vLatency, 99)));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
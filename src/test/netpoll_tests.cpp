@@ -0,0 +1,214 @@
+// Copyright (c) 2017 The e-Gulden Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netbase.h"
+#include "netpoll.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Connected pairs of loopback sockets, like a node with inbound peers */
+class CLoopbackPeers
+{
+public:
+    std::vector<SOCKET> vClient;
+    std::vector<SOCKET> vServer;
+
+    CLoopbackPeers(size_t nPeers)
+    {
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        BOOST_REQUIRE(hListen != INVALID_SOCKET);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&addr, len) == 0);
+        BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&addr, &len) == 0);
+        BOOST_REQUIRE(listen(hListen, SOMAXCONN) == 0);
+
+        for (size_t i = 0; i < nPeers; i++) {
+            SOCKET hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            BOOST_REQUIRE(hClient != INVALID_SOCKET);
+            BOOST_REQUIRE(connect(hClient, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+            SOCKET hServer = accept(hListen, NULL, NULL);
+            BOOST_REQUIRE(hServer != INVALID_SOCKET);
+            BOOST_REQUIRE(SetSocketNonBlocking(hServer, true));
+            vClient.push_back(hClient);
+            vServer.push_back(hServer);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~CLoopbackPeers()
+    {
+        for (size_t i = 0; i < vClient.size(); i++) {
+            if (vClient[i] != INVALID_SOCKET)
+                CloseSocket(vClient[i]);
+            CloseSocket(vServer[i]);
+        }
+    }
+};
+
+/** The pollers this system has */
+std::vector<CSocketPoller*> MakePollers()
+{
+    std::vector<CSocketPoller*> vPollers;
+    vPollers.push_back(new CSelectSocketPoller());
+#ifdef USE_POLL
+    CEpollSocketPoller* pepoll = new CEpollSocketPoller();
+    BOOST_REQUIRE(pepoll->IsValid());
+    vPollers.push_back(pepoll);
+#endif
+    return vPollers;
+}
+
+/** Events of one Wait(), by socket */
+std::map<SOCKET, int> WaitEvents(CSocketPoller* ppoller, int64_t nTimeout)
+{
+    std::vector<std::pair<SOCKET, int> > vEvents;
+    BOOST_CHECK(ppoller->Wait(nTimeout, vEvents));
+    return std::map<SOCKET, int>(vEvents.begin(), vEvents.end());
+}
+
+/** Read everything there is. Returns the number of bytes, or -1 if the peer closed. */
+int DrainSocket(SOCKET hSocket)
+{
+    char pchBuf[0x1000];
+    int nTotal = 0;
+    while (true) {
+        int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+        if (nBytes == 0)
+            return -1;
+        if (nBytes < 0)
+            return nTotal;
+        nTotal += nBytes;
+    }
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(netpoll_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(netpoll_edge_triggered)
+{
+    std::vector<CSocketPoller*> vPollers = MakePollers();
+    BOOST_FOREACH(CSocketPoller* ppoller, vPollers) {
+        BOOST_TEST_MESSAGE(ppoller->GetName());
+        CLoopbackPeers peers(1);
+        SOCKET hServer = peers.vServer[0];
+        BOOST_CHECK(ppoller->CanWatch(hServer));
+        BOOST_CHECK(ppoller->Add(hServer));
+
+        // A new connection can be written to, once
+        BOOST_CHECK_EQUAL(WaitEvents(ppoller, 100)[hServer], SOCKET_SEND);
+        BOOST_CHECK(WaitEvents(ppoller, 0).empty());
+
+        // Data is reported once, also when it is left unread
+        BOOST_CHECK_EQUAL(send(peers.vClient[0], "0123456789", 10, MSG_NOSIGNAL), 10);
+        BOOST_CHECK(WaitEvents(ppoller, 1000)[hServer] & SOCKET_RECV);
+        BOOST_CHECK(WaitEvents(ppoller, 0).empty());
+
+        // After draining and rearming, new data is reported again
+        BOOST_CHECK_EQUAL(DrainSocket(hServer), 10);
+        ppoller->Rearm(hServer, SOCKET_RECV);
+        BOOST_CHECK(WaitEvents(ppoller, 0).empty());
+        BOOST_CHECK_EQUAL(send(peers.vClient[0], "0123", 4, MSG_NOSIGNAL), 4);
+        BOOST_CHECK(WaitEvents(ppoller, 1000)[hServer] & SOCKET_RECV);
+
+        // A removed socket is not reported
+        BOOST_CHECK_EQUAL(DrainSocket(hServer), 4);
+        ppoller->Rearm(hServer, SOCKET_RECV);
+        ppoller->Remove(hServer);
+        BOOST_CHECK_EQUAL(send(peers.vClient[0], "0123", 4, MSG_NOSIGNAL), 4);
+        BOOST_CHECK(WaitEvents(ppoller, 100).empty());
+
+        delete ppoller;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(netpoll_loopback_stress)
+{
+    // Many peers sending at once, then half of them disconnecting. The
+    // select() poller is limited to FD_SETSIZE sockets; epoll gets as many
+    // as the file descriptor limit allows.
+    std::vector<CSocketPoller*> vPollers = MakePollers();
+    int nFD = RaiseFileDescriptorLimit(2200);
+    seed_insecure_rand(true);
+    BOOST_FOREACH(CSocketPoller* ppoller, vPollers) {
+        BOOST_TEST_MESSAGE(ppoller->GetName());
+        size_t nPeers = std::min(std::string(ppoller->GetName()) == "select" ? 400 : 1000, (nFD - 100) / 2);
+        CLoopbackPeers peers(nPeers);
+        std::map<SOCKET, size_t> mapPeer;
+        for (size_t i = 0; i < nPeers; i++) {
+            BOOST_REQUIRE(ppoller->Add(peers.vServer[i]));
+            mapPeer[peers.vServer[i]] = i;
+        }
+
+        for (int nRound = 0; nRound < 4; nRound++) {
+            std::vector<int> vExpected(nPeers, 0);
+            std::vector<int> vReceived(nPeers, 0);
+            int nPending = 0;
+            for (size_t i = 0; i < nPeers; i++) {
+                if (insecure_rand() % 2)
+                    continue;
+                char pchBuf[512] = {};
+                vExpected[i] = 1 + insecure_rand() % sizeof(pchBuf);
+                BOOST_REQUIRE_EQUAL(send(peers.vClient[i], pchBuf, vExpected[i], MSG_NOSIGNAL), vExpected[i]);
+                nPending++;
+            }
+
+            int64_t nDeadline = GetTimeMillis() + 10000;
+            while (nPending > 0 && GetTimeMillis() < nDeadline) {
+                std::map<SOCKET, int> mapEvents = WaitEvents(ppoller, 100);
+                for (std::map<SOCKET, int>::const_iterator it = mapEvents.begin(); it != mapEvents.end(); it++) {
+                    if (!(it->second & SOCKET_RECV))
+                        continue;
+                    BOOST_REQUIRE(mapPeer.count(it->first));
+                    size_t i = mapPeer[it->first];
+                    int nBytes = DrainSocket(it->first);
+                    BOOST_REQUIRE(nBytes >= 0);
+                    ppoller->Rearm(it->first, SOCKET_RECV);
+                    if (vReceived[i] < vExpected[i] && vReceived[i] + nBytes >= vExpected[i])
+                        nPending--;
+                    vReceived[i] += nBytes;
+                }
+            }
+            BOOST_CHECK_EQUAL(nPending, 0);
+            BOOST_CHECK(vReceived == vExpected);
+        }
+
+        // Disconnecting peers wake up their sockets
+        size_t nClosed = 0;
+        for (size_t i = 0; i < nPeers; i += 2) {
+            CloseSocket(peers.vClient[i]);
+            peers.vClient[i] = INVALID_SOCKET;
+            nClosed++;
+        }
+        size_t nSeenClosed = 0;
+        int64_t nDeadline = GetTimeMillis() + 10000;
+        while (nSeenClosed < nClosed && GetTimeMillis() < nDeadline) {
+            std::map<SOCKET, int> mapEvents = WaitEvents(ppoller, 100);
+            for (std::map<SOCKET, int>::const_iterator it = mapEvents.begin(); it != mapEvents.end(); it++) {
+                if (!(it->second & SOCKET_RECV))
+                    continue;
+                BOOST_CHECK_EQUAL(mapPeer[it->first] % 2, 0);
+                BOOST_CHECK_EQUAL(DrainSocket(it->first), -1);
+                ppoller->Remove(it->first);
+                nSeenClosed++;
+            }
+        }
+        BOOST_CHECK_EQUAL(nSeenClosed, nClosed);
+
+        delete ppoller;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,25 +5,34 @@
 #include "test/test_bitcoin.h"
 
 #include "base58.h"
+#include "chain.h"
+#include "compat.h"
 #include "oerushield/oerudb.h"
 #include "oerushield/oerushield.h"
+#include "oerushield/oerusignal.h"
 #include "oerushield/oerutx.h"
 #include "oerushield/signaturechecker.h"
+#include "sync.h"
+#include "utiltime.h"
 
 #include <boost/test/unit_test.hpp>
+#include <fstream>
 #include <string>
 
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/thread.h>
+
 BOOST_FIXTURE_TEST_SUITE(oerushield_tests, BasicTestingSetup)
 
-std::string GetTempFilePath()
+boost::filesystem::path GetTempFilePath()
 {
-    boost::filesystem::path tmpfile = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
-    return tmpfile.string().c_str();
+    return boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
 }
 
 BOOST_AUTO_TEST_CASE (oerudb_certified_addresses)
 {
-    COeruDB oeruDB(GetTempFilePath());
+    COeruDB oeruDB(GetTempFilePath(), 1 << 20, true);
 
     std::string addresses[] = {
         "LdwLvykqj2nUH3MWcut6mtjHxVxVFC7st5",
@@ -68,9 +77,8 @@ BOOST_AUTO_TEST_CASE (oerudb_certified_addresses)
 
 BOOST_AUTO_TEST_CASE (oerudb_read_write_dbfile)
 {
-    boost::filesystem::path tmpfile = boost::filesystem::temp_directory_path() / "oeru.db";
-
-    COeruDB writeOeruDB(tmpfile.string().c_str());
+    boost::filesystem::path dbpath = GetTempFilePath();
+    uint256 hashBlock = uint256S("0x6f00f6dc2d9b1a28b2e4f7ed87cb2b7b8dde4b1cc1b3ca0abe68e0dea0d2ea7d");
 
     std::string addresses[] = {
         "LdwLvykqj2nUH3MWcut6mtjHxVxVFC7st5",
@@ -78,28 +86,79 @@ BOOST_AUTO_TEST_CASE (oerudb_read_write_dbfile)
         "LWkdEB9SHUfuBiTvZofK2LqYE4RTTtUcqi"
     };
 
-    writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[0]));
-    writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[1]));
-    writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[2]));
+    {
+        COeruDB writeOeruDB(dbpath, 1 << 20);
 
-    BOOST_CHECK(writeOeruDB.NumCertifiedAddresses() == 3);
+        writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[0]));
+        writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[1]));
+        writeOeruDB.AddCertifiedAddress(CBitcoinAddress(addresses[2]));
+        writeOeruDB.SetBestBlock(hashBlock);
 
-    writeOeruDB.WriteFile();
+        BOOST_CHECK(writeOeruDB.NumCertifiedAddresses() == 3);
+        BOOST_CHECK(writeOeruDB.Flush());
 
-    COeruDB readOeruDB(tmpfile.string().c_str());
-    readOeruDB.ReadFile();
+        // Changes after the last flush are not written
+        writeOeruDB.RemoveCertifiedAddress(CBitcoinAddress(addresses[0]));
+        writeOeruDB.SetBestBlock(uint256());
+    }
 
-    BOOST_CHECK(readOeruDB.NumCertifiedAddresses() == 3);
+    {
+        COeruDB readOeruDB(dbpath, 1 << 20);
 
-    // Check certified == true
-    BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[0])) == true);
-    BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[1])) == true);
-    BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[2])) == true);
+        BOOST_CHECK(readOeruDB.NumCertifiedAddresses() == 3);
+        BOOST_CHECK(readOeruDB.GetBestBlock() == hashBlock);
+
+        // Check certified == true
+        BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[0])) == true);
+        BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[1])) == true);
+        BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[2])) == true);
+
+        readOeruDB.RemoveCertifiedAddress(CBitcoinAddress(addresses[1]));
+        BOOST_CHECK(readOeruDB.Flush());
+    }
+
+    {
+        COeruDB readOeruDB(dbpath, 1 << 20);
+
+        BOOST_CHECK(readOeruDB.NumCertifiedAddresses() == 2);
+        BOOST_CHECK(readOeruDB.IsAddressCertified(CBitcoinAddress(addresses[1])) == false);
+    }
+
+    // Wiping clears the addresses and the best block
+    {
+        COeruDB wipedOeruDB(dbpath, 1 << 20, false, true);
+
+        BOOST_CHECK(wipedOeruDB.NumCertifiedAddresses() == 0);
+        BOOST_CHECK(wipedOeruDB.GetBestBlock().IsNull());
+    }
+
+    boost::filesystem::remove_all(dbpath);
+}
+
+BOOST_AUTO_TEST_CASE (oerudb_import_legacy_file)
+{
+    boost::filesystem::path tmpfile = GetTempFilePath();
+
+    std::ofstream dbfile(tmpfile.string());
+    dbfile << "LdwLvykqj2nUH3MWcut6mtjHxVxVFC7st5" << std::endl;
+    dbfile << "LWZR9ybwmT8vSXP6tmrBX4b6nE9o94AjQG" << std::endl;
+    dbfile << "invalid" << std::endl;
+    dbfile.close();
+
+    COeruDB oeruDB(GetTempFilePath(), 1 << 20, true);
+    BOOST_CHECK(oeruDB.ImportFile(tmpfile.string()));
+
+    BOOST_CHECK(oeruDB.NumCertifiedAddresses() == 2);
+    BOOST_CHECK(oeruDB.IsAddressCertified(CBitcoinAddress("LdwLvykqj2nUH3MWcut6mtjHxVxVFC7st5")) == true);
+    BOOST_CHECK(oeruDB.IsAddressCertified(CBitcoinAddress("LWZR9ybwmT8vSXP6tmrBX4b6nE9o94AjQG")) == true);
+    BOOST_CHECK(oeruDB.GetBestBlock().IsNull());
+
+    boost::filesystem::remove(tmpfile);
 }
 
 BOOST_AUTO_TEST_CASE (oerudb_reindex)
 {
-    COeruDB oeruDB(GetTempFilePath());
+    COeruDB oeruDB(GetTempFilePath(), 1 << 20, true);
 
     // OeruShieldFirstMasterTXHeight: 941905 on mainnet
     BOOST_CHECK(oeruDB.ShouldReindex(940000) == false);
@@ -124,6 +183,48 @@ BOOST_AUTO_TEST_CASE (oerushield_is_master_key)
     BOOST_CHECK(oeruShield.IsMasterKey(CBitcoinAddress("LQHK6ejxSbjnu4XKa1XjprjmPhrtPdiJaG")) == false);
 }
 
+BOOST_AUTO_TEST_CASE (oerushield_blocks_since_last_certified)
+{
+    COeruDB oeruDB(GetTempFilePath(), 1 << 20, true);
+    COeruShield oeruShield(&oeruDB);
+
+    CKeyID certifiedKey(uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314")));
+    CKeyID otherKey(uint160(ParseHex("1413121110090807060504030201000f0e0d0c0b")));
+    oeruDB.AddCertifiedAddress(CBitcoinAddress(certifiedKey));
+
+    // Identification is already cached on every index, so none
+    // of these blocks need to be read back from disk
+    std::vector<CBlockIndex> blocks(12);
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        blocks[i].nHeight = i;
+        blocks[i].pprev = i > 0 ? &blocks[i - 1] : NULL;
+        blocks[i].nOeruIdentified = 0;
+    }
+    blocks[2].nOeruIdentified = 1;
+    blocks[2].oeruIdentityKey = certifiedKey;
+    blocks[5].nOeruIdentified = 1;
+    blocks[5].oeruIdentityKey = otherKey;
+
+    // OeruShieldMaxBlocksSinceLastCertified: 6 on mainnet
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[0]) == 0);
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[2]) == 0);
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[5]) == 3);
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[8]) == 6);
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[11]) == -1);
+
+    BOOST_CHECK(oeruShield.IsBlockCertified(NULL, &blocks[2]) == true);
+    BOOST_CHECK(oeruShield.IsBlockCertified(NULL, &blocks[5]) == false);
+
+    // Certification follows the database, identification is left alone
+    oeruDB.AddCertifiedAddress(CBitcoinAddress(otherKey));
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[8]) == 3);
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[11]) == 6);
+
+    // The genesis block counts as certified
+    oeruDB.RemoveCertifiedAddress(CBitcoinAddress(certifiedKey));
+    BOOST_CHECK(oeruShield.GetBlocksSinceLastCertified(NULL, &blocks[4]) == 4);
+}
+
 BOOST_AUTO_TEST_CASE (oerutxout_tests)
 {
     std::vector<unsigned char> data = ParseHex("4f455255010000006d1fa8b87567e351717ced5b7c4277cffec6d11f6474b566571759133ae6c4b6d0fc034333f30f2c11bd4f7974531bf42ba87dda9be7b6004d9ed514897133d51850");
@@ -208,4 +309,153 @@ BOOST_AUTO_TEST_CASE (oerusignature_checker)
     BOOST_CHECK(sigChecker.VerifySignature(msg2, sig2, addr1) == false);
 }
 
+/** Local HTTP server standing in for the signal host */
+class OeruSignalStub
+{
+public:
+    OeruSignalStub(bool fReply) : fReply(fReply)
+    {
+        evthread_use_pthreads();
+        base = event_base_new();
+        http = evhttp_new(base);
+        evhttp_set_gencb(http, request_cb, this);
+        evhttp_bound_socket *sock = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+        BOOST_REQUIRE(sock != NULL);
+
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        getsockname(evhttp_bound_socket_get_fd(sock), (struct sockaddr*)&addr, &len);
+        port = ntohs(addr.sin_port);
+
+        thread = boost::thread(boost::bind(&event_base_dispatch, base));
+    }
+
+    ~OeruSignalStub()
+    {
+        // Unlike loopbreak, this is not lost if dispatch did not start yet
+        event_base_loopexit(base, NULL);
+        thread.join();
+        evhttp_free(http);
+        event_base_free(base);
+    }
+
+    std::string GetLastPath()
+    {
+        LOCK(cs);
+        return strLastPath;
+    }
+
+    int port;
+private:
+    static void request_cb(struct evhttp_request *req, void *ctx)
+    {
+        OeruSignalStub *self = static_cast<OeruSignalStub*>(ctx);
+        {
+            LOCK(self->cs);
+            self->strLastPath = evhttp_request_get_uri(req);
+        }
+        // Without a reply the client has to run into its timeout
+        if (self->fReply)
+            evhttp_send_reply(req, 200, "OK", NULL);
+    }
+
+    bool fReply;
+    CCriticalSection cs;
+    std::string strLastPath;
+    struct event_base *base;
+    struct evhttp *http;
+    boost::thread thread;
+};
+
+static COeruSignalStats WaitForSignals(const COeruSignal& signal, uint64_t nDone)
+{
+    COeruSignalStats stats;
+    for (int i = 0; i < 100; i++) {
+        stats = signal.GetStats();
+        if (stats.nSent + stats.nFailed >= nDone)
+            break;
+        MilliSleep(50);
+    }
+    return stats;
+}
+
+BOOST_AUTO_TEST_CASE (oerusignal_execute_throttled)
+{
+    COeruSignal signal("test");
+
+    // Not started, so the signal stays queued
+    BOOST_CHECK(signal.ExecuteOeruSignal(100) == true);
+    BOOST_CHECK(signal.ExecuteOeruSignal(200) == false);
+
+    COeruSignalStats stats = signal.GetStats();
+    BOOST_CHECK(stats.nQueued == 1);
+    BOOST_CHECK(stats.nQueueSize == 1);
+}
+
+BOOST_AUTO_TEST_CASE (oerusignal_queue_bounded)
+{
+    COeruSignal signal("test", "127.0.0.1", 80, 1, 2);
+
+    BOOST_CHECK(signal.QueueSignal("/a") == true);
+    BOOST_CHECK(signal.QueueSignal("/b") == true);
+    BOOST_CHECK(signal.QueueSignal("/c") == false);
+
+    COeruSignalStats stats = signal.GetStats();
+    BOOST_CHECK(stats.nQueued == 2);
+    BOOST_CHECK(stats.nDropped == 1);
+    BOOST_CHECK(stats.nQueueSize == 2);
+}
+
+BOOST_AUTO_TEST_CASE (oerusignal_send_to_stub)
+{
+    OeruSignalStub stub(true);
+    COeruSignal signal("test", "127.0.0.1", stub.port, 2);
+    BOOST_REQUIRE(signal.Start());
+
+    BOOST_CHECK(signal.QueueSignal("/test:1:2:3") == true);
+    BOOST_CHECK(signal.QueueSignal("/test:4:5:6") == true);
+
+    COeruSignalStats stats = WaitForSignals(signal, 2);
+    BOOST_CHECK(stats.nSent == 2);
+    BOOST_CHECK(stats.nFailed == 0);
+    BOOST_CHECK(stats.nQueueSize == 0);
+    BOOST_CHECK(stats.nLastLatency > 0);
+    BOOST_CHECK(stub.GetLastPath() == "/test:4:5:6");
+
+    signal.Stop();
+}
+
+BOOST_AUTO_TEST_CASE (oerusignal_timeout)
+{
+    OeruSignalStub stub(false);
+    COeruSignal signal("test", "127.0.0.1", stub.port, 1);
+    BOOST_REQUIRE(signal.Start());
+
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK(signal.QueueSignal("/test:1:2:3") == true);
+
+    COeruSignalStats stats = WaitForSignals(signal, 1);
+    BOOST_CHECK(stats.nSent == 0);
+    BOOST_CHECK(stats.nFailed == 1);
+    BOOST_CHECK(GetTimeMillis() - nStart < 3000);
+
+    signal.Stop();
+}
+
+BOOST_AUTO_TEST_CASE (oerusignal_stop_aborts_request)
+{
+    OeruSignalStub stub(false);
+    COeruSignal signal("test", "127.0.0.1", stub.port, 30);
+
+    // Stopping must not wait for the 30 second timeout, wherever the worker is
+    for (int nDelay = 0; nDelay < 200; nDelay += 50) {
+        BOOST_REQUIRE(signal.Start());
+        BOOST_CHECK(signal.QueueSignal("/test:1:2:3") == true);
+        MilliSleep(nDelay);
+        int64_t nStart = GetTimeMillis();
+        signal.Stop();
+        BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,12 +4,17 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "kgw.h"
+#include "main.h"
 #include "pow.h"
 #include "random.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
+#include <math.h>
+
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -95,4 +100,98 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(check_headers_pow_batch)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // Every even header passes, every odd header fails
+    std::vector<CBlockHeader> headers;
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    for (int i = 0; i < 32; i++) {
+        header.nTime++;
+        while (CheckProofOfWork(header.GetPoWHash(), header.nBits, params) != (i % 2 == 0))
+            header.nNonce++;
+        headers.push_back(header);
+    }
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(&ThreadHeaderCheck);
+
+    for (int nThreads = 0; nThreads <= 4; nThreads += 4) {
+        nHeaderCheckThreads = nThreads;
+
+        std::vector<unsigned char> vPoWChecked(headers.size(), 0);
+        BOOST_CHECK(!CheckBlockHeadersPoW(headers, vPoWChecked, params));
+        for (unsigned int i = 0; i < headers.size(); i++) {
+            // A failure may stop a worker before it gets to later headers
+            if (i % 2 == 1)
+                BOOST_CHECK(!vPoWChecked[i]);
+        }
+        if (nThreads == 0) {
+            for (unsigned int i = 0; i < headers.size(); i += 2)
+                BOOST_CHECK(vPoWChecked[i]);
+        }
+
+        // Headers that are marked as checked are skipped
+        for (unsigned int i = 1; i < headers.size(); i += 2)
+            vPoWChecked[i] = 1;
+        BOOST_CHECK(CheckBlockHeadersPoW(headers, vPoWChecked, params));
+        for (unsigned int i = 0; i < headers.size(); i++)
+            BOOST_CHECK(vPoWChecked[i]);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nHeaderCheckThreads = 0;
+}
+
+/* The cached Kimoto Gravity Well must return exactly what the reference calculation returns */
+BOOST_AUTO_TEST_CASE(kgw_cache_matches_reference)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    const uint64_t nTargetSpacing = 120;
+    const uint64_t PastBlocksMin = 21600 / 512;
+    const uint64_t PastBlocksMax = 604800 / 512;
+
+    // Blocks arrive irregularly, from a few seconds to four minutes apart
+    std::vector<CBlockIndex> blocks(400);
+    uint32_t nRand = 12345;
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+        nRand = nRand * 1103515245 + 12345;
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = i ? blocks[i - 1].nTime + 5 + (nRand >> 16) % 230 : 1400000000;
+        blocks[i].nBits = i ? CalculateKimotoGravityWell(blocks[i].pprev, nTargetSpacing, PastBlocksMin, PastBlocksMax, params) : 0x1e0ffff0;
+    }
+
+    // Ask twice, the second time is answered from the cache
+    for (int n = 0; n < 2; n++) {
+        for (unsigned int i = 0; i + 1 < blocks.size(); i++)
+            BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[i], nTargetSpacing, PastBlocksMin, PastBlocksMax, params), blocks[i + 1].nBits);
+    }
+
+    // A competing block gets its own entry, and doesn't disturb its parent's
+    CBlockIndex fork = blocks[350];
+    fork.nTime += 3600;
+    fork.nKGWNextBits = 0;
+    unsigned int nForkReference = CalculateKimotoGravityWell(&fork, nTargetSpacing, PastBlocksMin, PastBlocksMax, params);
+    BOOST_CHECK_EQUAL(KimotoGravityWell(&fork, nTargetSpacing, PastBlocksMin, PastBlocksMax, params), nForkReference);
+    BOOST_CHECK(nForkReference != blocks[351].nBits);
+    BOOST_CHECK_EQUAL(KimotoGravityWell(&blocks[350], nTargetSpacing, PastBlocksMin, PastBlocksMax, params), blocks[351].nBits);
+}
+
+/* The EventHorizonDeviation table is consensus critical, it must hold exactly what pow() returns here */
+BOOST_AUTO_TEST_CASE(kgw_event_horizon_table)
+{
+    for (uint64_t PastBlocksMass = 1; PastBlocksMass <= 2 * 604800 / 512; PastBlocksMass++) {
+        double EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass) / double(144)), -1.228));
+        double TableDeviation = GetEventHorizonDeviation(PastBlocksMass);
+        BOOST_CHECK_MESSAGE(memcmp(&EventHorizonDeviation, &TableDeviation, sizeof(double)) == 0,
+                            strprintf("EventHorizonDeviation mismatch at PastBlocksMass %d", PastBlocksMass));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
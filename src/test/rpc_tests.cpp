@@ -6,18 +6,30 @@
 #include "rpc/client.h"
 
 #include "base58.h"
+#include "chainparams.h"
+#include "jsonwriter.h"
+#include "main.h"
 #include "netbase.h"
+#include "pow.h"
+#include "txmempool.h"
 
 #include "test/test_bitcoin.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
 using namespace std;
 
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSONStream(CJSONWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSONStream(CJSONWriter& writer, bool fVerbose = false);
+
 UniValue
 createArgs(int nRequired, const char* address1=NULL, const char* address2=NULL)
 {
@@ -332,4 +344,219 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_FIXTURE_TEST_CASE(rpc_generate_threads, TestChain100Setup)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::string strAddress = CBitcoinAddress(coinbaseKey.GetPubKey().GetID()).ToString();
+
+    int nHeightStart = chainActive.Height();
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("generatetoaddress 5 " + strAddress + " 1000000 4"));
+    BOOST_REQUIRE_EQUAL(r.size(), 5U);
+    for (unsigned int i = 0; i < r.size(); i++) {
+        uint256 hash = uint256S(r[i].get_str());
+        CBlock block;
+        {
+            LOCK(cs_main);
+            BOOST_REQUIRE(mapBlockIndex.count(hash));
+            CBlockIndex* pindex = mapBlockIndex[hash];
+            BOOST_CHECK(chainActive.Contains(pindex));
+            BOOST_CHECK_EQUAL(pindex->nHeight, nHeightStart + 1 + (int)i);
+            BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, consensusParams));
+        }
+        BOOST_CHECK(CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams));
+
+        // The threads share out the nonces without gaps, so the lowest solution
+        // is the one found, just like a search on one thread would find
+        CBlockHeader header = block.GetBlockHeader();
+        for (header.nNonce = 0; header.nNonce < block.nNonce; header.nNonce++)
+            BOOST_CHECK(!CheckProofOfWork(header.GetPoWHash(), header.nBits, consensusParams));
+    }
+    BOOST_CHECK(find_value(CallRPC("getmininginfo").get_obj(), "generatehashps").get_int64() > 0);
+
+    // 0 and negative counts are relative to the number of cores
+    BOOST_CHECK_NO_THROW(CallRPC("generatetoaddress 1 " + strAddress + " 1000000 0"));
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeightStart + 6);
+
+    BOOST_CHECK_THROW(CallRPC("generatetoaddress 1 " + strAddress + " 1000000 65"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("generatetoaddress 1 " + strAddress + " 1000000 -1000"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("generatetoaddress 1 " + strAddress + " 1000000 two"), runtime_error);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeightStart + 6);
+}
+
+namespace
+{
+/** What the batch test commands saw of each other */
+boost::mutex csBatchTest;
+int nBatchTestActive = 0;
+int nBatchTestMaxActive = 0;
+bool fBatchTestWriting = false;
+bool fBatchTestOverlap = false;
+int nBatchTestQueued = 0;
+
+UniValue BatchTestCall(const UniValue& params, bool fWrite)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csBatchTest);
+        if (fBatchTestWriting || (fWrite && nBatchTestActive > 0))
+            fBatchTestOverlap = true;
+        fBatchTestWriting = fWrite;
+        nBatchTestActive++;
+        nBatchTestMaxActive = std::max(nBatchTestMaxActive, nBatchTestActive);
+    }
+    // Give the other calls of the batch time to start alongside
+    MilliSleep(10);
+    {
+        boost::unique_lock<boost::mutex> lock(csBatchTest);
+        nBatchTestActive--;
+        if (fWrite)
+            fBatchTestWriting = false;
+    }
+    return params[0];
+}
+
+UniValue batchtestread(const UniValue& params, bool fHelp) { return BatchTestCall(params, false); }
+UniValue batchtestwrite(const UniValue& params, bool fHelp) { return BatchTestCall(params, true); }
+
+const CRPCCommand batchTestCommands[] = {
+    { "hidden", "batchtestread", &batchtestread, true, true },
+    { "hidden", "batchtestwrite", &batchtestwrite, true, false },
+};
+
+/** Like QueueHTTPWork, on a thread of its own */
+bool QueueOnThread(boost::thread_group* threads, const boost::function<void ()>& work)
+{
+    nBatchTestQueued++;
+    threads->create_thread(work);
+    return true;
+}
+
+/** Like QueueHTTPWork with a full work queue */
+bool RejectWork(const boost::function<void ()>& work)
+{
+    return false;
+}
+
+/** Run the batch and check the replies are in request order */
+void CheckBatch(const UniValue& vReq, const RPCQueueWorkFn& queueWork)
+{
+    nBatchTestMaxActive = 0;
+    fBatchTestOverlap = false;
+    nBatchTestQueued = 0;
+    UniValue vReply;
+    BOOST_REQUIRE(vReply.read(JSONRPCExecBatch(vReq, queueWork)));
+    BOOST_REQUIRE_EQUAL(vReply.size(), vReq.size());
+    for (size_t i = 0; i < vReply.size(); i++) {
+        BOOST_CHECK(find_value(vReply[i], "error").isNull());
+        BOOST_CHECK_EQUAL(find_value(vReply[i], "id").get_int(), (int)i);
+        BOOST_CHECK_EQUAL(find_value(vReply[i], "result").get_int(), (int)i);
+    }
+    // Calls that change state never run alongside others
+    BOOST_CHECK(!fBatchTestOverlap);
+    BOOST_CHECK_EQUAL(nBatchTestActive, 0);
+}
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    // The commands go through CRPCTable::execute, which needs the warmup done
+    bool fRegistered = true;
+    for (size_t i = 0; i < ARRAYLEN(batchTestCommands); i++)
+        fRegistered = tableRPC.appendCommand(batchTestCommands[i].name, &batchTestCommands[i]) && fRegistered;
+    if (fRegistered)
+        SetRPCWarmupFinished();
+    mapArgs["-rpcbatchparallel"] = "4";
+
+    // Runs of reads, separated by single and consecutive writes
+    const char* vMethods[] = {"batchtestread", "batchtestread", "batchtestread", "batchtestread", "batchtestread",
+        "batchtestread", "batchtestread", "batchtestread", "batchtestread", "batchtestwrite", "batchtestread", "batchtestread", "batchtestread", "batchtestwrite", "batchtestwrite",
+        "batchtestread", "batchtestwrite", "batchtestread", "batchtestread"};
+    UniValue vReq(UniValue::VARR);
+    for (size_t i = 0; i < ARRAYLEN(vMethods); i++) {
+        UniValue req(UniValue::VOBJ);
+        req.push_back(Pair("method", vMethods[i]));
+        UniValue params(UniValue::VARR);
+        params.push_back((int)i);
+        req.push_back(Pair("params", params));
+        req.push_back(Pair("id", (int)i));
+        vReq.push_back(req);
+    }
+
+    // Helpers on real threads
+    boost::thread_group threads;
+    CheckBatch(vReq, boost::bind(&QueueOnThread, &threads, _1));
+    threads.join_all();
+    BOOST_CHECK(nBatchTestMaxActive <= 4);
+    // Helpers still waiting from one run of reads are counted for the next
+    // one, and short runs get none
+    BOOST_CHECK(nBatchTestQueued > 0);
+    BOOST_CHECK(nBatchTestQueued <= 3);
+
+    // A full work queue leaves the calls to the thread executing the batch
+    CheckBatch(vReq, &RejectWork);
+    BOOST_CHECK_EQUAL(nBatchTestMaxActive, 1);
+
+    // As does -rpcbatchparallel=1
+    mapArgs["-rpcbatchparallel"] = "1";
+    CheckBatch(vReq, boost::bind(&QueueOnThread, &threads, _1));
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nBatchTestMaxActive, 1);
+    mapArgs.erase("-rpcbatchparallel");
+}
+
+namespace
+{
+bool AppendChunk(std::string* pstrOut, int* pnChunks, const std::string& strChunk)
+{
+    *pstrOut += strChunk;
+    (*pnChunks)++;
+    return true;
+}
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_results)
+{
+    // The genesis block, with enough made up transactions to need several chunks
+    CBlock block;
+    CBlockIndex* pindex = chainActive.Tip();
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+    std::vector<CMutableTransaction> vtx(20);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].prevout = COutPoint(i ? vtx[i - 1].GetHash() : block.vtx[0].GetHash(), 0);
+        vtx[i].vout.resize(i % 3 + 1);
+        for (size_t j = 0; j < vtx[i].vout.size(); j++) {
+            vtx[i].vout[j].nValue = (i + 1) * CENT + j;
+            vtx[i].vout[j].scriptPubKey = CScript() << OP_TRUE;
+        }
+        block.vtx.push_back(vtx[i]);
+    }
+
+    for (int fTxDetails = 0; fTxDetails <= 1; fTxDetails++) {
+        std::string strStream;
+        int nChunks = 0;
+        CJSONWriter writer(boost::bind(AppendChunk, &strStream, &nChunks, _1), 256);
+        blockToJSONStream(writer, block, pindex, fTxDetails);
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK(nChunks > 2);
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(strStream, blockToJSON(block, pindex, fTxDetails).write());
+    }
+
+    // The same transactions in the mempool, each spending the one before
+    TestMemPoolEntryHelper entry;
+    for (size_t i = 0; i < vtx.size(); i++)
+        mempool.addUnchecked(vtx[i].GetHash(), entry.Fee(1000 * i).Time(GetTime() + i).FromTx(vtx[i], &mempool));
+    for (int fVerbose = 0; fVerbose <= 1; fVerbose++) {
+        std::string strStream;
+        int nChunks = 0;
+        CJSONWriter writer(boost::bind(AppendChunk, &strStream, &nChunks, _1), 256);
+        mempoolToJSONStream(writer, fVerbose);
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK(nChunks > 2);
+        BOOST_CHECK_EQUAL(strStream, mempoolToJSON(fVerbose).write());
+    }
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -32,4 +32,36 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi_hashtest)
+{
+    // Test the multi-lane kernel against the generic one, with batch sizes
+    // that do and don't fill all lanes
+    std::vector<std::vector<unsigned char> > inputbytes;
+    for (int i = 0; i < 3 * SCRYPT_MAX_WAYS + 1; i++) {
+        std::vector<unsigned char> input(80);
+        for (int j = 0; j < 80; j++)
+            input[j] = (unsigned char)(i * 80 + j);
+        inputbytes.push_back(input);
+    }
+
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<uint256> expected(inputbytes.size());
+    for (unsigned int i = 0; i < inputbytes.size(); i++)
+        scrypt_1024_1_1_256_sp_generic((const char*)&inputbytes[i][0], BEGIN(expected[i]), &scratchpad[0]);
+
+    BOOST_TEST_MESSAGE("scrypt multi-lane kernel: " << scrypt_multi_impl());
+    for (unsigned int n = 0; n <= inputbytes.size(); n++) {
+        std::vector<uint256> hashes(n);
+        std::vector<const char*> inputs(n + 1);
+        std::vector<char*> outputs(n + 1);
+        for (unsigned int i = 0; i < n; i++) {
+            inputs[i] = (const char*)&inputbytes[i][0];
+            outputs[i] = BEGIN(hashes[i]);
+        }
+        scrypt_1024_1_1_256_sp_multi(&inputs[0], &outputs[0], n, &scratchpad[0]);
+        for (unsigned int i = 0; i < n; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
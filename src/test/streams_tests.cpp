@@ -64,4 +64,26 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    CDataStream ds(SER_NETWORK, PROTOCOL_VERSION);
+    ds << (uint32_t)0x01020304 << std::string("span") << (uint8_t)7;
+    std::vector<char> vch(ds.begin(), ds.end());
+
+    CSpanReader span(SER_NETWORK, PROTOCOL_VERSION, &vch[0], &vch[0] + vch.size());
+    uint32_t n;
+    std::string str;
+    span >> n >> str;
+    BOOST_CHECK_EQUAL(n, 0x01020304U);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK_EQUAL(span.size(), 1U);
+
+    // Reading past the end throws, and leaves the rest in place
+    BOOST_CHECK_THROW(span >> n, std::ios_base::failure);
+    uint8_t c;
+    span >> c;
+    BOOST_CHECK_EQUAL(c, 7);
+    BOOST_CHECK(span.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
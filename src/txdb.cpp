@@ -7,15 +7,22 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
+#include "memusage.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
+#include "utiltime.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -26,17 +33,36 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+namespace {
+
+/** Database key of a single unspent output: DB_COIN, txid, VARINT(n) */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+}
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -52,10 +78,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -65,10 +92,190 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, size_t &nBytes) {
+    CDBBatch batch(db);
+    size_t changed = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
+            changed++;
+        }
+    }
+    if (!hashBlock.IsNull())
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    nBytes = batch.SizeEstimate();
+
+    LogPrint("coindb", "Committing %u changed transaction outputs (%u bytes) to coin database...\n", (unsigned int)changed, (unsigned int)nBytes);
+    return db.WriteBatch(batch);
+}
+
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsViewDB *pdbIn) : CCoinsViewBacked(pdbIn), pdb(pdbIn), fWriting(false), fWriteOk(true), fStop(false)
+{
+    threadWriter = boost::thread(boost::bind(&CCoinsViewFlusher::ThreadWrite, this));
+}
+
+CCoinsViewFlusher::~CCoinsViewFlusher()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+        condWriter.notify_one();
+    }
+    threadWriter.join();
+}
+
+bool CCoinsViewFlusher::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(csFlushing);
+        CCoinsMap::const_iterator it = mapFlushing.find(outpoint);
+        if (it != mapFlushing.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    // Entries only leave mapFlushing once they are in the database
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewFlusher::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(csFlushing);
+        CCoinsMap::const_iterator it = mapFlushing.find(outpoint);
+        if (it != mapFlushing.end())
+            return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewFlusher::GetBestBlock() const {
+    {
+        boost::shared_lock<boost::shared_mutex> lock(csFlushing);
+        if (!hashFlushing.IsNull())
+            return hashFlushing;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!Sync())
+        return false;
+
+    // Entries that are not dirty are in the database already
+    size_t nUsage = 0;
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            nUsage += it->second.coin.DynamicMemoryUsage();
+            it++;
+        } else {
+            mapCoins.erase(it++);
+        }
+    }
+    nUsage += memusage::DynamicUsage(mapCoins);
+
+    {
+        // mapFlushing was emptied by the completed write
+        boost::unique_lock<boost::shared_mutex> lock(csFlushing);
+        mapFlushing.swap(mapCoins);
+        hashFlushing = hashBlock;
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    stats.nPendingCoins = mapFlushing.size();
+    stats.nPendingUsage = nUsage;
+    fWriting = true;
+    condWriter.notify_one();
+    return true;
+}
+
+bool CCoinsViewFlusher::Sync() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (fWriting) {
+        int64_t nStart = GetTimeMicros();
+        while (fWriting)
+            condDone.wait(lock);
+        stats.nTotalWait += GetTimeMicros() - nStart;
+    }
+    return fWriteOk;
+}
+
+bool CCoinsViewFlusher::HasFailed() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return !fWriting && !fWriteOk;
+}
+
+size_t CCoinsViewFlusher::DynamicMemoryUsage() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return stats.nPendingUsage;
+}
+
+CCoinsFlushStats CCoinsViewFlusher::GetStats() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return stats;
+}
+
+void CCoinsViewFlusher::ThreadWrite()
+{
+    RenameThread("egulden-coinsflush");
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (true) {
+        // A write that was handed over before the stop request still goes out
+        while (!fWriting && !fStop)
+            condWriter.wait(lock);
+        if (!fWriting)
+            return;
+        lock.unlock();
+
+        // Only this thread reads mapFlushing for writing, and nobody modifies it while fWriting is set
+        int64_t nStart = GetTimeMicros();
+        size_t nBytes = 0;
+        bool fOk = false;
+        try {
+            fOk = pdb->WriteCoins(mapFlushing, hashFlushing, nBytes);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        int64_t nDuration = GetTimeMicros() - nStart;
+
+        size_t nCoins = mapFlushing.size();
+        if (fOk) {
+            CCoinsMap mapDone;
+            {
+                boost::unique_lock<boost::shared_mutex> lockFlushing(csFlushing);
+                mapDone.swap(mapFlushing);
+                hashFlushing.SetNull();
+            }
+            LogPrint("coindb", "Wrote %u coins (%u bytes) to coin database in %.2fms\n", (unsigned int)nCoins, (unsigned int)nBytes, 0.001 * nDuration);
+        } else {
+            // Keep serving the entries; HasFailed() and the next Sync() report the failure
+            LogPrintf("%s: failed to write %u coins to coin database\n", __func__, (unsigned int)nCoins);
+        }
+
+        lock.lock();
+        if (fOk) {
+            stats.nFlushes++;
+            stats.nLastCoins = nCoins;
+            stats.nLastBytes = nBytes;
+            stats.nLastDuration = nDuration;
+            stats.nLastTime = GetTime();
+            stats.nTotalBytes += nBytes;
+            stats.nTotalDuration += nDuration;
+            stats.nPendingCoins = 0;
+            stats.nPendingUsage = 0;
+        }
+        fWriteOk = fOk;
+        fWriting = false;
+        condDone.notify_all();
+    }
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -98,25 +305,31 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    if (i->pcursor->Valid()) {
+        CoinEntry entry(&i->keyTmp.second);
+        i->pcursor->GetKey(entry);
+        i->keyTmp.first = entry.key;
+    } else {
+        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+    }
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -126,14 +339,18 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else {
+        keyTmp.first = entry.key;
+    }
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -219,3 +436,148 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+namespace {
+
+//! Legacy class to deserialize pre-per-outpoint chainstate entries ("CCoins"):
+//! all unspent outputs of a transaction under a single key.
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    //! empty constructor
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    /**
+     * Serialized format:
+     * - VARINT(nVersion)
+     * - VARINT(nCode)
+     * - unspentness bitvector, for vout[2] and further; least significant byte first
+     * - the non-spent CTxOuts (via CTxOutCompressor)
+     * - VARINT(nHeight)
+     *
+     * The nCode value consists of:
+     * - bit 0: IsCoinBase()
+     * - bit 1: vout[0] is not spent
+     * - bit 2: vout[1] is not spent
+     * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+     *   - In case both bit 1 and bit 2 are unset, they encode N-1, as there must be at
+     *     least one non-spent output).
+     */
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+}
+
+/** Upgrade the database from the per-transaction format (DB_COINS) to the
+ * per-output format (DB_COIN). Every legacy entry is replaced by its unspent
+ * outputs in the same batch, so the conversion can be interrupted at any
+ * point and resumed on the next start.
+ */
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<char, uint256> key;
+    std::pair<char, uint256> prev_key = make_pair(DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                // Keys are ordered by txid, so its first two bytes tell how far along we are
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: failed to write upgraded coins", __func__);
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write upgraded coins", __func__);
+    db.CompactRange(make_pair(DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s]. %d transactions in %dms\n", ShutdownRequested() ? "CANCELLED" : "DONE", count, GetTimeMillis() - nStart);
+    return !ShutdownRequested();
+}
@@ -16,6 +16,10 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
@@ -69,11 +73,100 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Write the dirty entries of mapCoins and the best block in one batch, leaving mapCoins untouched.
+    //! nBytes is set to the size of the batch.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, size_t &nBytes);
+
+    //! Convert a chainstate written with one entry per transaction to one entry per output.
+    //! Returns false on error or when interrupted by a shutdown request.
+    bool Upgrade();
+};
+
+/** Statistics of the chainstate writes done by a CCoinsViewFlusher */
+struct CCoinsFlushStats
+{
+    //! Number of completed writes
+    uint64_t nFlushes;
+    //! Dirty entries, batch size and duration (µs) of the last write
+    uint64_t nLastCoins;
+    uint64_t nLastBytes;
+    int64_t nLastDuration;
+    //! Completion time of the last write
+    int64_t nLastTime;
+    //! Sums over all writes
+    uint64_t nTotalBytes;
+    int64_t nTotalDuration;
+    //! Time (µs) callers spent waiting for a write to finish
+    int64_t nTotalWait;
+    //! Dirty entries of the write in progress, if any, and the memory they take
+    uint64_t nPendingCoins;
+    uint64_t nPendingUsage;
+
+    CCoinsFlushStats() : nFlushes(0), nLastCoins(0), nLastBytes(0), nLastDuration(0), nLastTime(0),
+                         nTotalBytes(0), nTotalDuration(0), nTotalWait(0), nPendingCoins(0), nPendingUsage(0) {}
+};
+
+/**
+ * Writes the chainstate to a CCoinsViewDB in the background.
+ *
+ * BatchWrite() takes over the dirty entries of the flushing cache and
+ * returns right away; a writer thread then serializes them into a CDBBatch
+ * and commits it. Until the write is done the entries are served from here,
+ * so validation continues on top of them. The batch ends with the best block
+ * marker and is committed atomically, so after a crash the database is
+ * either at the old or at the new best block.
+ *
+ * At most one write is in flight: BatchWrite() first waits for the previous
+ * one. Call Sync() where the state has to be on disk, and before using the
+ * database directly (Cursor() does not see a write in progress).
+ */
+class CCoinsViewFlusher : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *pdb;
+
+    //! Guards mapFlushing and hashFlushing. Readers share it with each other and with the writer thread.
+    mutable boost::shared_mutex csFlushing;
+    CCoinsMap mapFlushing;
+    uint256 hashFlushing;
+
+    //! Guards the state below
+    mutable boost::mutex cs;
+    boost::condition_variable condWriter;
+    boost::condition_variable condDone;
+    bool fWriting;
+    bool fWriteOk;
+    bool fStop;
+    CCoinsFlushStats stats;
+
+    boost::thread threadWriter;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewFlusher(CCoinsViewDB *pdbIn);
+    //! Finishes the write in progress
+    ~CCoinsViewFlusher();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Wait until the write in progress is on disk. Returns false if a write failed.
+    bool Sync();
+    //! Whether the last write failed, without waiting for the one in progress
+    bool HasFailed() const;
+    //! Memory taken by the coins of the write in progress
+    size_t DynamicMemoryUsage() const;
+
+    CCoinsFlushStats GetStats() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -82,8 +175,8 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
@@ -93,7 +186,7 @@ private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
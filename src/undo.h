@@ -12,17 +12,19 @@
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent and its metadata (coinbase or
+ *  not, height). Undo data written before the per-outpoint UTXO set only
+ *  has the metadata if this was the last unspent output of the affected
+ *  transaction; elsewhere nHeight is 0. The transaction version is no longer
+ *  tracked, it is written as 0 to keep the format unchanged.
  */
 class CTxInUndo
 {
 public:
     CTxOut txout;         // the txout data before being spent
-    bool fCoinBase;       // if the outpoint was the last unspent: whether it belonged to a coinbase
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
+    bool fCoinBase;       // whether it belonged to a coinbase
+    unsigned int nHeight; // its height, 0 if unknown
+    int nVersion;         // unused, kept for the serialization format
 
     CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
     CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) { }